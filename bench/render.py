@@ -0,0 +1,413 @@
+#!/usr/bin/env python3
+#
+# Benchmark of the rendering of follow on a virtual terminal
+#
+# Usage: render.py [--follow=PATH] [--size=ROWSxCOLS] [--repeat=N] [--option=OPT...] [--show] [FILE...]
+#
+# follow is run on a pseudo-terminal with each FILE as the output of its command (by default, the outputs of the
+# workloads of the pgo directory), and a sequence of keys is replayed: scrolling by lines and by pages, panning
+# horizontally, jumping to the top and the bottom, and resizing the terminal. What follow writes to the terminal is
+# consumed by a small VT parser, so that it can be checked with --show. For each kind of operation, the number of
+# frames drawn, the bytes written and the time from the key to the last byte of the frame are reported, followed by the
+# CPU time follow used over the whole run, in which the composition of the frames is not hidden by the latency of the
+# pseudo-terminal.
+
+import os
+import pty
+import time
+import fcntl
+import shlex
+import struct
+import select
+import signal
+import termios
+import argparse
+import tempfile
+import subprocess
+import unicodedata
+
+# A frame is considered complete when the terminal received nothing for that long
+QUIET = 0.02
+
+# Operations that produce no frame, e.g. scrolling past the end, are given up after that long
+NO_FRAME = 0.2
+
+class Screen:
+	"""
+	Minimal VT100/xterm screen, enough for what ncurses sends with TERM=xterm.
+
+	Attributes are ignored; only the characters end up on the screen.
+	"""
+
+	def __init__( self, rows, cols ):
+		self.resize( rows, cols )
+		self.state = "text"
+		self.seq = ""
+		self.pending = b""
+
+	def resize( self, rows, cols ):
+		self.rows = rows
+		self.cols = cols
+		self.grid = [ [ " " ] * cols for _ in range( rows ) ]
+		self.y = 0
+		self.x = 0
+		self.top = 0
+		self.bottom = rows - 1
+		self.saved = ( 0, 0 )
+		self.last = " "
+
+	def lines( self ):
+		return [ "".join( c for c in row if c is not None ).rstrip() for row in self.grid ]
+
+	def scroll( self, n, top = None ):
+		top = self.top if top is None else top
+		for _ in range( n ):
+			del self.grid[top]
+			self.grid.insert( self.bottom, [ " " ] * self.cols )
+
+	def reverse_scroll( self, n, top = None ):
+		top = self.top if top is None else top
+		for _ in range( n ):
+			del self.grid[self.bottom]
+			self.grid.insert( top, [ " " ] * self.cols )
+
+	def line_feed( self ):
+		if self.y == self.bottom:
+			self.scroll( 1 )
+		elif self.y < self.rows - 1:
+			self.y += 1
+
+	def put( self, c ):
+		width = 2 if unicodedata.east_asian_width( c ) in "WF" else 1
+		if unicodedata.combining( c ):
+			return
+		if self.x + width > self.cols:
+			self.x = 0
+			self.line_feed()
+		self.grid[self.y][self.x] = c
+		if width == 2:
+			self.grid[self.y][self.x + 1] = None
+		self.x += width
+		self.last = c
+
+	def feed( self, data ):
+		data = self.pending + data
+		try:
+			text = data.decode( "utf-8" )
+			self.pending = b""
+		except UnicodeDecodeError as err:
+			# A sequence cut at the end of the data is completed by the next one
+			text = data[:err.start].decode( "utf-8" )
+			self.pending = data[err.start:]
+			if len( self.pending ) >= 4:
+				text += self.pending.decode( "utf-8", "replace" )
+				self.pending = b""
+
+		for c in text:
+			self.char( c )
+
+	def char( self, c ):
+		if self.state == "text":
+			if c == "\x1b":
+				self.state = "escape"
+				self.seq = ""
+			elif c == "\r":
+				self.x = 0
+			elif c == "\n" or c == "\x0b" or c == "\x0c":
+				self.line_feed()
+			elif c == "\b":
+				self.x = max( min( self.x, self.cols - 1 ) - 1, 0 )
+			elif c == "\t":
+				self.x = min( ( self.x // 8 + 1 ) * 8, self.cols - 1 )
+			elif c >= " " and c != "\x7f":
+				self.put( c )
+		elif self.state == "escape":
+			if c == "[":
+				self.state = "csi"
+			elif c == "]":
+				self.state = "osc"
+			elif c in "()*+#%":
+				self.state = "charset"
+			else:
+				self.state = "text"
+				self.escape( c )
+		elif self.state == "charset":
+			self.state = "text"
+		elif self.state == "osc":
+			if c == "\x07":
+				self.state = "text"
+			elif c == "\x1b":
+				self.state = "osc-end"
+		elif self.state == "osc-end":
+			self.state = "text"
+		elif self.state == "csi":
+			if "@" <= c <= "~":
+				self.state = "text"
+				self.csi( self.seq, c )
+			else:
+				self.seq += c
+
+	def escape( self, c ):
+		if c == "7":
+			self.saved = ( self.y, self.x )
+		elif c == "8":
+			self.y, self.x = self.saved
+		elif c == "D":
+			self.line_feed()
+		elif c == "E":
+			self.x = 0
+			self.line_feed()
+		elif c == "M":
+			if self.y == self.top:
+				self.reverse_scroll( 1 )
+			elif self.y > 0:
+				self.y -= 1
+		elif c == "c":
+			self.resize( self.rows, self.cols )
+
+	def csi( self, seq, final ):
+		# Private modes, e.g. the alternate screen or the keypad mode, do not change the characters
+		if seq and seq[0] in "?>=<":
+			return
+
+		params = [ int( p ) if p.isdigit() else 0 for p in seq.split( ";" ) ] if seq else []
+		first = params[0] if params else 0
+		n = max( first, 1 )
+		row = self.grid[self.y]
+
+		if final in "Hf":
+			self.y = min( max( n - 1, 0 ), self.rows - 1 )
+			self.x = min( max( ( params[1] if len( params ) > 1 else 1 ) - 1, 0 ), self.cols - 1 )
+		elif final == "A":
+			self.y = max( self.y - n, 0 )
+		elif final == "B":
+			self.y = min( self.y + n, self.rows - 1 )
+		elif final == "C":
+			self.x = min( self.x + n, self.cols - 1 )
+		elif final == "D":
+			self.x = max( min( self.x, self.cols - 1 ) - n, 0 )
+		elif final == "G":
+			self.x = min( n - 1, self.cols - 1 )
+		elif final == "d":
+			self.y = min( n - 1, self.rows - 1 )
+		elif final == "K":
+			start, end = { 0: ( self.x, self.cols ), 1: ( 0, self.x + 1 ) }.get( first, ( 0, self.cols ) )
+			for i in range( start, min( end, self.cols ) ):
+				row[i] = " "
+		elif final == "J":
+			if first == 0:
+				self.csi( "", "K" )
+				for y in range( self.y + 1, self.rows ):
+					self.grid[y] = [ " " ] * self.cols
+			elif first == 1:
+				for y in range( 0, self.y ):
+					self.grid[y] = [ " " ] * self.cols
+				self.csi( "1", "K" )
+			else:
+				self.grid = [ [ " " ] * self.cols for _ in range( self.rows ) ]
+		elif final == "X":
+			for i in range( self.x, min( self.x + n, self.cols ) ):
+				row[i] = " "
+		elif final == "P":
+			del row[self.x:self.x + n]
+			row.extend( [ " " ] * ( self.cols - len( row ) ) )
+		elif final == "@":
+			for _ in range( n ):
+				row.insert( self.x, " " )
+			del row[self.cols:]
+		elif final == "L":
+			if self.top <= self.y <= self.bottom:
+				self.reverse_scroll( n, self.y )
+		elif final == "M":
+			if self.top <= self.y <= self.bottom:
+				self.scroll( n, self.y )
+		elif final == "S":
+			self.scroll( n )
+		elif final == "T":
+			self.reverse_scroll( n )
+		elif final == "b":
+			for _ in range( n ):
+				self.put( self.last )
+		elif final == "r":
+			self.top = max( ( params[0] if params and params[0] else 1 ) - 1, 0 )
+			self.bottom = min( ( params[1] if len( params ) > 1 and params[1] else self.rows ) - 1, self.rows - 1 )
+			self.y = 0
+			self.x = 0
+		elif final == "s":
+			self.saved = ( self.y, self.x )
+		elif final == "u":
+			self.y, self.x = self.saved
+
+class Terminal:
+	"""
+	follow running on a pseudo-terminal, whose output is read by the benchmark.
+	"""
+
+	def __init__( self, argv, rows, cols ):
+		self.screen = Screen( rows, cols )
+		self.master, slave = pty.openpty()
+		self.set_size( rows, cols )
+
+		env = dict( os.environ, TERM = "xterm", LC_ALL = os.environ.get( "LC_ALL", "C.UTF-8" ) )
+		env.pop( "LINES", None )
+		env.pop( "COLUMNS", None )
+		self.process = subprocess.Popen( argv, stdin = slave, stdout = slave, stderr = slave, env = env, start_new_session = True, preexec_fn = lambda: fcntl.ioctl( 0, termios.TIOCSCTTY, 0 ) )
+		os.close( slave )
+
+	def set_size( self, rows, cols ):
+		# The kernel sends SIGWINCH to the program on the terminal
+		fcntl.ioctl( self.master, termios.TIOCSWINSZ, struct.pack( "HHHH", rows, cols, 0, 0 ) )
+
+	def frame( self, timeout ):
+		"""
+		Read a frame, returning its bytes and the time at which the last one arrived, or None if nothing came.
+		"""
+		data = bytearray()
+		last = None
+		deadline = time.monotonic() + timeout
+
+		while True:
+			wait = deadline - time.monotonic() if last is None else QUIET
+			ready, _, _ = select.select( [ self.master ], [], [], max( wait, 0 ) )
+			if not ready:
+				break
+			try:
+				chunk = os.read( self.master, 65536 )
+			except OSError:
+				break
+			if not chunk:
+				break
+			data += chunk
+			last = time.monotonic()
+
+		return bytes( data ), last
+
+	def close( self ):
+		"""
+		Quit follow, returning the CPU time it used over the whole run, in seconds.
+		"""
+		os.write( self.master, b"q" )
+		deadline = time.monotonic() + 5.
+		while True:
+			pid, status, usage = os.wait4( self.process.pid, os.WNOHANG )
+			if pid != 0:
+				break
+			if time.monotonic() > deadline:
+				self.process.send_signal( signal.SIGKILL )
+				pid, status, usage = os.wait4( self.process.pid, 0 )
+				break
+			time.sleep( 0.01 )
+		self.process.returncode = os.waitstatus_to_exitcode( status )
+		os.close( self.master )
+		return usage.ru_utime + usage.ru_stime
+
+class Stats:
+	def __init__( self ):
+		self.ops = 0
+		self.frames = 0
+		self.bytes = 0
+		self.time = 0.
+		self.max_time = 0.
+
+	def add( self, n_bytes, elapsed ):
+		self.ops += 1
+		if elapsed is not None:
+			self.frames += 1
+			self.bytes += n_bytes
+			self.time += elapsed
+			self.max_time = max( self.max_time, elapsed )
+
+def run( follow, options, path, rows, cols, repeat, show ):
+	"""
+	Replay the operations on one recorded output, returning the statistics of each of them in order.
+	"""
+	# The interval is long enough that the command is only executed once
+	terminal = Terminal( [ follow, "-n", "3600" ] + options + [ "--", "cat", path ], rows, cols )
+	results = []
+
+	def measure( name, keys, size = None ):
+		stats = Stats()
+		for i in range( repeat ):
+			start = time.monotonic()
+			if size is not None:
+				new_rows, new_cols = size( i )
+				terminal.set_size( new_rows, new_cols )
+				terminal.screen.resize( new_rows, new_cols )
+			else:
+				os.write( terminal.master, keys )
+			data, last = terminal.frame( NO_FRAME )
+			stats.add( len( data ), None if last is None else last - start )
+			terminal.screen.feed( data )
+		results.append( ( name, stats ) )
+
+	# The first frame also includes the execution of the command and the decoding of its output, before which only the
+	# title is drawn
+	stats = Stats()
+	start = time.monotonic()
+	n_bytes = 0
+	last = None
+	while time.monotonic() < start + 10. and sum( 1 for line in terminal.screen.lines() if line ) < 2:
+		data, frame_last = terminal.frame( start + 10. - time.monotonic() )
+		n_bytes += len( data )
+		last = frame_last or last
+		terminal.screen.feed( data )
+	stats.add( n_bytes, None if last is None else last - start )
+	results.append( ( "first", stats ) )
+
+	measure( "line-down", b"j" )
+	measure( "line-up", b"k" )
+	measure( "page-down", b" " )
+	measure( "page-up", b"b" )
+	measure( "pan-right", b"\x1bOC" )
+	measure( "pan-left", b"\x1bOD" )
+	measure( "bottom", b"G" )
+	measure( "top", b"g" )
+	measure( "resize", None, lambda i: ( rows - 5, cols - 20 ) if i % 2 == 0 else ( rows, cols ) )
+
+	if show:
+		print( "\n".join( terminal.screen.lines() ) )
+
+	cpu = terminal.close()
+	return results, cpu
+
+def record_workloads( directory ):
+	"""
+	Record the outputs of the workloads of the pgo directory, returning the paths to them.
+	"""
+	workloads = os.path.join( os.path.dirname( os.path.abspath( __file__ ) ), "..", "pgo" )
+	paths = []
+	for name in [ "table", "utf8", "long-lines" ]:
+		path = os.path.join( directory, name + ".txt" )
+		with open( path, "wb" ) as output:
+			subprocess.run( [ "sh", os.path.join( workloads, name + ".sh" ) ], stdout = output, check = True )
+		paths.append( path )
+	return paths
+
+def main():
+	parser = argparse.ArgumentParser( description = "Benchmark the rendering of follow on a virtual terminal" )
+	parser.add_argument( "files", nargs = "*", help = "Recorded outputs (default: those of the pgo workloads)" )
+	parser.add_argument( "--follow", default = "./follow", help = "Program to benchmark (default: ./follow)" )
+	parser.add_argument( "--size", default = "50x160", help = "Size of the terminal, as ROWSxCOLS (default: 50x160)" )
+	parser.add_argument( "--repeat", type = int, default = 50, help = "Number of times each operation is made (default: 50)" )
+	parser.add_argument( "--option", action = "append", default = [], help = "Option for follow, e.g. --option=-N" )
+	parser.add_argument( "--show", action = "store_true", help = "Print the final screen of each run" )
+	args = parser.parse_args()
+
+	rows, cols = ( int( v ) for v in args.size.split( "x" ) )
+	options = [ o for option in args.option for o in shlex.split( option ) ]
+
+	with tempfile.TemporaryDirectory() as directory:
+		files = args.files if args.files else record_workloads( directory )
+
+		for path in files:
+			print( "%s (%d bytes)" % ( path if args.files else os.path.basename( path ), os.path.getsize( path ) ) )
+			print( "  %-10s %6s %6s %10s %10s %10s %10s" % ( "operation", "ops", "frames", "bytes", "bytes/fr", "ms/frame", "max ms" ) )
+			results, cpu = run( args.follow, options, path, rows, cols, args.repeat, args.show )
+			for name, stats in results:
+				per_frame = stats.bytes / stats.frames if stats.frames else 0.
+				mean = 1000. * stats.time / stats.frames if stats.frames else 0.
+				print( "  %-10s %6d %6d %10d %10.0f %10.2f %10.2f" % ( name, stats.ops, stats.frames, stats.bytes, per_frame, mean, 1000. * stats.max_time ) )
+			print( "  CPU time of follow over the run: %.0f ms" % ( 1000. * cpu ) )
+
+if __name__ == "__main__":
+	main()
@@ -21,26 +21,97 @@
 #endif
 
 #include <stdlib.h>
+#include <stddef.h> /* For max_align_t */
+#include <stdint.h>
 #include <string.h>
 #include <wchar.h>
 
+#include <stdarg.h>
 #include <limits.h> /* For PIPE_BUF */
 #include <errno.h>
 #include <locale.h>
 #include <signal.h>
+#include <sched.h>
 
 #include <time.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <sys/param.h> /* For MIN(), MAX() */
+#include <sys/resource.h>
+#include <sys/ioctl.h>
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <termios.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 #include <ncurses.h>
 
+/* Declared by term.h, which is not included since it defines a macro for each terminfo capability, e.g. lines */
+extern int setupterm( const char* term, int fd, int* err );
+
+/* Static tracepoints for bpftrace, perf, etc., which cost a no-op instruction when not traced */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define PROBE0( name ) STAP_PROBE( follow, name )
+#define PROBE1( name, a ) STAP_PROBE1( follow, name, a )
+#define PROBE2( name, a, b ) STAP_PROBE2( follow, name, a, b )
+#else
+#define PROBE0( name ) do {} while ( 0 )
+#define PROBE1( name, a ) do {} while ( 0 )
+#define PROBE2( name, a, b ) do {} while ( 0 )
+#endif
+
+/**
+ * CPUs and scheduling of a process; what is not set is left as it is, i.e. inherited from the parent.
+ */
+struct placement {
+	int has_cpus;
+	cpu_set_t cpus;
+	int policy; /* SCHED_OTHER, SCHED_BATCH or SCHED_IDLE, or -1 if not set */
+	int has_nice;
+	long int nice;
+};
+
+/**
+ * Apply a placement to the calling process.
+ *
+ * Returns 0 on success, or -1 if an error occurred, in which case errno is set and what is the name of the call that
+ * failed.
+ */
+int apply_placement( const struct placement* placement, const char** what ) {
+	if ( placement->has_cpus && sched_setaffinity( 0, sizeof( cpu_set_t ), &placement->cpus ) < 0 ) {
+		( *what ) = "sched_setaffinity";
+		return -1;
+	}
+
+	if ( placement->policy >= 0 ) {
+		struct sched_param param = { .sched_priority = 0 };
+		if ( sched_setscheduler( 0, placement->policy, &param ) < 0 ) {
+			( *what ) = "sched_setscheduler";
+			return -1;
+		}
+	}
+
+	if ( placement->has_nice && setpriority( PRIO_PROCESS, 0, placement->nice ) < 0 ) {
+		( *what ) = "setpriority";
+		return -1;
+	}
 
-int run_command( char* const* args, int* fd )  {
+	return 0;
+}
+
+/**
+ * Start a command with its output redirected to a new pipe, whose reading end is stored in fd.
+ *
+ * If envp is not NULL, it is used as the environment of the command instead of the current one. If pass_target is
+ * not negative, the command gets pass_fd as that file descriptor, or /dev/null if pass_fd is negative. The command is
+ * moved to the given placement before being executed.
+ */
+int run_command( char* const* args, char* const* envp, int pass_fd, int pass_target, const struct placement* placement, int* fd )  {
 	int pipefds[2];
 	int piperes = pipe( pipefds );
 	if ( piperes == -1 ) {
@@ -76,8 +147,34 @@ int run_command( char* const* args, int* fd )  {
 		close( pipefds[0] );
 		close( pipefds[1] );
 
+		/* hand over the extra file descriptor, without the close-on-exec flag */
+		if ( pass_target >= 0 ) {
+			if ( pass_fd < 0 ) {
+				int fd_null = open( "/dev/null", O_RDONLY );
+				if ( fd_null != pass_target ) {
+					dup2( fd_null, pass_target );
+					close( fd_null );
+				}
+			} else if ( pass_fd == pass_target ) {
+				fcntl( pass_fd, F_SETFD, 0 );
+			} else {
+				dup2( pass_fd, pass_target );
+			}
+		}
+
+		/* move to the CPUs and scheduling class of the commands; an error goes to the output */
+		const char* failed = NULL;
+		if ( apply_placement( placement, &failed ) < 0 ) {
+			perror( failed );
+			exit( 1 );
+		}
+
 		/* the following never returns, except if an error occurred */
-		execvp( args[0], args );
+		if ( envp != NULL ) {
+			execvpe( args[0], args, envp );
+		} else {
+			execvp( args[0], args );
+		}
 		perror( "execvp" );
 		exit( 1 );
 	} else {
@@ -96,17 +193,381 @@ int run_command( char* const* args, int* fd )  {
 	}
 }
 
-int get_command_output( pid_t* pid, int* fd, int* output_err, size_t* output_len, size_t* output_alloc, char** output_buf ) {
+/**
+ * Parts of the program whose memory is accounted separately.
+ */
+enum memory_use {
+	MEMORY_CAPTURE, /* raw outputs of the commands */
+	MEMORY_SNAPSHOTS, /* snapshots and the arenas that hold the decoded outputs */
+	MEMORY_TEXT, /* wide characters of the decoded outputs, within the arenas */
+	MEMORY_LINES, /* line indexes of the decoded outputs, within the arenas */
+	MEMORY_TITLES, /* compiled and rendered titles */
+	MEMORY_SAMPLES, /* statistics of the samples taken with --oversample */
+	MEMORY_CACHES, /* tables and flags of the diff and of the marks */
+	MEMORY_EXPORTS, /* shared memory of --shm */
+	MEMORY_CONTROL, /* buffers of the control clients */
+	MEMORY_SCREEN, /* frames of the direct renderer */
+	N_MEMORY_USES
+};
+
+static const char* const memory_use_names[N_MEMORY_USES] = { "capture", "snapshots", "text", "lines", "titles", "samples", "caches", "exports", "control", "screen" };
+
+/* Bytes currently allocated for each use, and the most there has been */
+static size_t memory_current[N_MEMORY_USES];
+static size_t memory_peak[N_MEMORY_USES];
+
+/* Whether the memory use is reported on exit, see --memory-report */
+static int memory_report = 0;
+
+/* Ways in which memory is given back to the system: trimming a block that stays allocated, and unmapping a large one */
+enum release_kind {
+	RELEASE_TRIM,
+	RELEASE_UNMAP,
+	N_RELEASE_KINDS
+};
+
+static const char* const release_kind_names[N_RELEASE_KINDS] = { "trim", "unmap" };
+
+/* Number of releases of each kind and the decrease of the resident set size they caused, with --memory-report */
+static size_t release_count[N_RELEASE_KINDS];
+static size_t release_resident[N_RELEASE_KINDS];
+
+/**
+ * Record that an allocation for the given use changed from old_size to new_size bytes.
+ */
+void account_memory( enum memory_use use, size_t old_size, size_t new_size ) {
+	memory_current[use] = memory_current[use] - old_size + new_size;
+	if ( memory_current[use] > memory_peak[use] ) memory_peak[use] = memory_current[use];
+}
+
+/**
+ * Header in front of the allocations of tracked_realloc(), recording their size; its size keeps them aligned as
+ * malloc() does.
+ */
+union tracked_header {
+	size_t size;
+	max_align_t align;
+};
+
+/**
+ * Allocate, resize or free (when size is zero) a block of the heap as realloc() does, accounting it for the given use.
+ *
+ * The block must only be handled by these functions. Returns the new block, or NULL if an error occurred or the block
+ * was freed; on error, the old block is left unchanged.
+ */
+void* tracked_realloc( enum memory_use use, void* block, size_t size ) {
+	union tracked_header* header = block == NULL ? NULL : (union tracked_header*) block - 1;
+	const size_t old_size = header == NULL ? 0 : header->size;
+
+	if ( size == 0 ) {
+		free( header );
+		account_memory( use, old_size, 0 );
+		return NULL;
+	}
+
+	if ( size > SIZE_MAX - sizeof( union tracked_header ) ) return NULL;
+	union tracked_header* new = realloc( header, sizeof( union tracked_header ) + size );
+	if ( new == NULL ) return NULL;
+
+	new->size = size;
+	account_memory( use, old_size, size );
+	return new + 1;
+}
+
+/**
+ * Allocate a zeroed array from the heap as calloc() does, accounting it for the given use.
+ */
+void* tracked_calloc( enum memory_use use, size_t n, size_t size ) {
+	if ( size != 0 && n > SIZE_MAX / size ) return NULL;
+
+	void* block = tracked_realloc( use, NULL, MAX( n * size, 1 ) );
+	if ( block != NULL ) memset( block, 0, n * size );
+	return block;
+}
+
+/**
+ * Free a block allocated by tracked_realloc() or tracked_calloc().
+ */
+void tracked_free( enum memory_use use, void* block ) {
+	if ( block != NULL ) tracked_realloc( use, block, 0 );
+}
+
+/**
+ * Get the resident set size of the program, in bytes, or 0 if it cannot be read.
+ *
+ * Only system calls are used, without any allocation, so that this can be called around each release of memory and
+ * from print_memory().
+ */
+size_t resident_bytes() {
+	int fd = open( "/proc/self/statm", O_RDONLY | O_CLOEXEC );
+	if ( fd < 0 ) return 0;
+
+	char buf[128];
+	const ssize_t n = read( fd, buf, sizeof( buf ) - 1 );
+	close( fd );
+	if ( n <= 0 ) return 0;
+	buf[n] = '\0';
+
+	/* The second field is the number of resident pages */
+	const char* pos = memchr( buf, ' ', n );
+	if ( pos == NULL ) return 0;
+
+	size_t pages = 0;
+	for ( pos++; *pos >= '0' && *pos <= '9'; pos++ ) pages = 10 * pages + ( *pos - '0' );
+	return pages * sysconf( _SC_PAGESIZE );
+}
+
+/**
+ * Record a release of memory of the given kind, given the resident set size before it.
+ */
+void record_release( enum release_kind kind, size_t before ) {
+	const size_t after = resident_bytes();
+
+	release_count[kind]++;
+	if ( after < before ) release_resident[kind] += before - after;
+}
+
+/**
+ * Append a string to a line, padded with spaces to the given width, on the left if right is set.
+ *
+ * Returns the new length of the line.
+ */
+size_t append_column( char* line, size_t len, const char* str, size_t width, int right ) {
+	const size_t str_len = strlen( str );
+	const size_t pad = str_len < width ? width - str_len : 0;
+
+	if ( right ) {
+		memset( line + len, ' ', pad );
+		len += pad;
+	}
+	memcpy( line + len, str, str_len );
+	len += str_len;
+	if ( !right ) {
+		memset( line + len, ' ', pad );
+		len += pad;
+	}
+
+	return len;
+}
+
+/**
+ * Format a size in decimal into buf, which must hold at least 21 bytes, and return it.
+ */
+const char* format_size( char* buf, size_t size ) {
+	char* pos = buf + 20;
+	*pos = '\0';
+	do {
+		*--pos = '0' + size % 10;
+		size /= 10;
+	} while ( size > 0 );
+	return pos;
+}
+
+/**
+ * Write the current and peak memory of each use, in bytes.
+ *
+ * This is called by safe_exit(), possibly from a signal handler, so the lines are formatted by hand and written with
+ * write() rather than through stdio, which is not async-signal-safe.
+ */
+void print_memory( int fd ) {
+	char line[64];
+	char buf[21];
+	size_t len;
+
+	len = append_column( line, 0, "use", 10, 0 );
+	line[len++] = ' ';
+	len = append_column( line, len, "current", 14, 1 );
+	line[len++] = ' ';
+	len = append_column( line, len, "peak", 14, 1 );
+	line[len++] = '\n';
+	if ( write( fd, line, len ) < 0 ) return;
+
+	for ( int u = 0; u < N_MEMORY_USES; u++ ) {
+		len = append_column( line, 0, memory_use_names[u], 10, 0 );
+		line[len++] = ' ';
+		len = append_column( line, len, format_size( buf, memory_current[u] ), 14, 1 );
+		line[len++] = ' ';
+		len = append_column( line, len, format_size( buf, memory_peak[u] ), 14, 1 );
+		line[len++] = '\n';
+		if ( write( fd, line, len ) < 0 ) return;
+	}
+
+	/* Resident set size of the whole program, which the trims and unmaps below reduce */
+	struct rusage usage;
+	len = append_column( line, 0, "resident", 10, 0 );
+	line[len++] = ' ';
+	len = append_column( line, len, format_size( buf, resident_bytes() ), 14, 1 );
+	line[len++] = ' ';
+	len = append_column( line, len, getrusage( RUSAGE_SELF, &usage ) == 0 ? format_size( buf, (size_t) usage.ru_maxrss * 1024 ) : "-", 14, 1 );
+	line[len++] = '\n';
+	if ( write( fd, line, len ) < 0 ) return;
+
+	len = append_column( line, 0, "released", 10, 0 );
+	line[len++] = ' ';
+	len = append_column( line, len, "count", 14, 1 );
+	line[len++] = ' ';
+	len = append_column( line, len, "resident", 14, 1 );
+	line[len++] = '\n';
+	if ( write( fd, line, len ) < 0 ) return;
+
+	for ( int k = 0; k < N_RELEASE_KINDS; k++ ) {
+		len = append_column( line, 0, release_kind_names[k], 10, 0 );
+		line[len++] = ' ';
+		len = append_column( line, len, format_size( buf, release_count[k] ), 14, 1 );
+		line[len++] = ' ';
+		len = append_column( line, len, format_size( buf, release_resident[k] ), 14, 1 );
+		line[len++] = '\n';
+		if ( write( fd, line, len ) < 0 ) return;
+	}
+}
+
+/* Size from which blocks are mapped on their own, so that their pages can be given back to the system */
+#define LARGE_BLOCK ( 2 * 1024 * 1024 )
+
+/**
+ * Allocate a block of memory for the given use.
+ *
+ * Large blocks are mapped directly, with transparent huge pages requested to reduce TLB misses when they are scanned.
+ */
+void* alloc_block( enum memory_use use, size_t size ) {
+	void* block;
+	if ( size < LARGE_BLOCK ) {
+		block = malloc( size );
+		if ( block == NULL ) return NULL;
+	} else {
+		block = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+		if ( block == MAP_FAILED ) return NULL;
+
+#ifdef MADV_HUGEPAGE
+		madvise( block, size, MADV_HUGEPAGE );
+#endif
+	}
+
+	account_memory( use, 0, size );
+	return block;
+}
+
+/**
+ * Free a block allocated by alloc_block() or resize_block(), given its size.
+ */
+void free_block( enum memory_use use, void* block, size_t size ) {
+	if ( block == NULL ) return;
+
+	account_memory( use, size, 0 );
+	if ( size < LARGE_BLOCK ) {
+		free( block );
+	} else {
+		const size_t before = memory_report ? resident_bytes() : 0;
+		munmap( block, size );
+		if ( memory_report ) record_release( RELEASE_UNMAP, before );
+	}
+}
+
+/**
+ * Resize a block allocated by alloc_block(), preserving its contents.
+ *
+ * Returns the new block, or NULL if an error occurred, in which case the old block is left unchanged.
+ */
+void* resize_block( enum memory_use use, void* block, size_t old_size, size_t new_size ) {
+	if ( block == NULL ) return alloc_block( use, new_size );
+
+	if ( ( old_size < LARGE_BLOCK ) == ( new_size < LARGE_BLOCK ) ) {
+		void* new = old_size < LARGE_BLOCK ? realloc( block, new_size ) : mremap( block, old_size, new_size, MREMAP_MAYMOVE );
+		if ( new == NULL || new == MAP_FAILED ) return NULL;
+
+		account_memory( use, old_size, new_size );
+		return new;
+	}
+
+	void* new = alloc_block( use, new_size );
+	if ( new == NULL ) return NULL;
+	memcpy( new, block, MIN( old_size, new_size ) );
+	free_block( use, block, old_size );
+
+	return new;
+}
+
+/**
+ * Give the pages of a large block that lie past its first keep bytes back to the system.
+ *
+ * The block stays allocated; its contents past keep are lost and read as zeros when touched again.
+ */
+void trim_block( void* block, size_t size, size_t keep ) {
+	if ( block == NULL || size < LARGE_BLOCK ) return;
+
+	const size_t page = sysconf( _SC_PAGESIZE );
+	const size_t start = ( keep + page - 1 ) / page * page;
+	if ( start >= size ) return;
+
+	/* Unlike MADV_FREE, the pages are released right away, and no longer count in the resident set */
+	const size_t before = memory_report ? resident_bytes() : 0;
+	madvise( (char*) block + start, size - start, MADV_DONTNEED );
+	if ( memory_report ) record_release( RELEASE_TRIM, before );
+}
+
+/**
+ * Get the current and the peak resident set sizes of the program, in kilobytes.
+ *
+ * Returns 0 on success, and -1 if they could not be read.
+ */
+int resident_memory( long int* rss, long int* peak ) {
+	FILE* file = fopen( "/proc/self/status", "r" );
+	if ( file == NULL ) return -1;
+
+	( *rss ) = -1;
+	( *peak ) = -1;
+
+	char line[256];
+	while ( fgets( line, sizeof( line ), file ) != NULL ) {
+		sscanf( line, "VmRSS: %ld", rss );
+		sscanf( line, "VmHWM: %ld", peak );
+	}
+	fclose( file );
+
+	return ( *rss ) < 0 || ( *peak ) < 0 ? -1 : 0;
+}
+
+/**
+ * Resize an output buffer to hold new_alloc bytes plus a terminating NUL byte.
+ *
+ * The buffer is either allocated on the heap or, if memfd is not negative, a shared mapping of that memory file.
+ * Returns the new buffer, or NULL if an error occurred, in which case the old buffer is left unchanged.
+ */
+char* resize_output_buf( char* buf, size_t old_alloc, size_t new_alloc, int memfd ) {
+	if ( memfd < 0 ) {
+		return (char*) resize_block( MEMORY_CAPTURE, (void*) buf, buf == NULL ? 0 : old_alloc + 1, new_alloc + 1 );
+	}
+
+	if ( ftruncate( memfd, new_alloc + 1 ) < 0 ) {
+		return NULL;
+	}
+
+	void* new;
+	if ( buf == NULL ) {
+		new = mmap( NULL, new_alloc + 1, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0 );
+	} else {
+		new = mremap( (void*) buf, old_alloc + 1, new_alloc + 1, MREMAP_MAYMOVE );
+	}
+	if ( new == MAP_FAILED ) return NULL;
+
+	account_memory( MEMORY_CAPTURE, buf == NULL ? 0 : old_alloc + 1, new_alloc + 1 );
+	return (char*) new;
+}
+
+int get_command_output( pid_t* pid, int* fd, int* exit_status, int memfd, int* output_err, size_t* output_len, size_t* output_alloc, char** output_buf ) {
 	for (;;) {
 		if ( ( *output_alloc ) < ( *output_len ) + PIPE_BUF ) {
-			char* new = (char*) realloc( (void*)( *output_buf ), ( *output_len ) + PIPE_BUF + 1 );
+			/* Grow geometrically and keep the capacity across runs, so that output of a stable size needs no resize */
+			size_t new_alloc = MAX( ( *output_len ) + PIPE_BUF, 2 * ( *output_alloc ) );
+
+			char* new = resize_output_buf( ( *output_buf ), ( *output_alloc ), new_alloc, memfd );
 
 			if ( new == NULL ) {
 				( *output_err ) = errno;
 			} else {
-				new[( *output_len ) + PIPE_BUF] = '\0'; /* ensure the buffer is NUL terminated */
+				new[new_alloc] = '\0'; /* ensure the buffer is NUL terminated */
 				( *output_buf ) = new;
-				( *output_alloc ) = ( *output_len ) + PIPE_BUF;
+				( *output_alloc ) = new_alloc;
 			}
 		}
 
@@ -127,92 +588,158 @@ int get_command_output( pid_t* pid, int* fd, int* output_err, size_t* output_len
 			( *fd ) = -1;
 			break;
 		} else if ( nread == 0 ) {
+			PROBE2( eof, ( *pid ), ( *output_len ) );
 			( *output_buf )[( *output_len )] = '\0'; /* ensure the current output is NUL terminated */
+
+			/* The capacity is kept, but the memory left over from a much larger previous output is released */
+			if ( memfd < 0 && ( *output_len ) < ( *output_alloc ) / 4 ) {
+				trim_block( ( *output_buf ), ( *output_alloc ) + 1, ( *output_len ) + 1 );
+			}
 			close( *fd );
 			( *fd ) = -1;
 			break;
 		} else if ( !( *output_err ) ) {
+			if ( ( *output_len ) == 0 ) PROBE2( first_byte, ( *pid ), nread );
 			( *output_len ) += nread;
 		}
 	}
 
-	waitpid( ( *pid ), NULL, 0 );
+	/* Report the exit status as a shell would, i.e. 128 plus the signal number if the command was killed */
+	int status = 0;
+	waitpid( ( *pid ), &status, 0 );
+	( *exit_status ) = WIFSIGNALED( status ) ? 128 + WTERMSIG( status ) : WEXITSTATUS( status );
+	PROBE2( exit, ( *pid ), ( *exit_status ) );
 	( *pid ) = -1;
 
 	return 1;
 }
 
 /**
- * Convert the raw output from a command into an array of lines while counting its width and height.
+ * Bump allocator, whose allocations are all released at once by resetting it.
+ *
+ * The block is kept across resets, so that refilling an arena with data of a similar size does not allocate.
+ */
+struct arena {
+	size_t size;
+	size_t used;
+	size_t touched; /* how much of the block may be resident, at most */
+	char* base;
+	size_t allocated[N_MEMORY_USES]; /* bytes allocated from the arena for each use */
+};
+
+/* Alignment of the allocations from an arena, enough for any of the types stored in it */
+#define ARENA_ALIGN 16
+
+/**
+ * Release all the allocations of an arena, keeping its block as it is.
  */
-void convert_output( size_t output_len, char* output_buf, size_t* display_len, size_t* display_alloc, wchar_t** display_buf, int* res_max_height, int* res_max_width, size_t* lines_alloc, wchar_t*** lines, int** lines_len ) {
-	( *res_max_height ) = 0;
-	( *res_max_width ) = 0;
+void arena_release( struct arena* arena ) {
+	arena->touched = MAX( arena->touched, arena->used );
+	arena->used = 0;
 
-	if ( output_len == ( size_t ) -1 ) return;
+	for ( int u = 0; u < N_MEMORY_USES; u++ ) {
+		account_memory( u, arena->allocated[u], 0 );
+		arena->allocated[u] = 0;
+	}
+}
 
-	/* Allocate wide-character array and zero it */
-	if ( output_len + 1 > ( *display_alloc ) ) {
-		wchar_t* new = ( wchar_t* ) realloc( ( void* )( *display_buf ), sizeof( wchar_t ) * ( output_len + 1 ) );
-		if ( new != NULL ) {
-			( *display_buf ) = new;
-			( *display_alloc ) = output_len + 1;
+/**
+ * Release all the allocations of an arena and make sure that its block holds at least size bytes.
+ *
+ * Returns 0 on success, or -1 if the block could not be allocated, in which case the arena is empty.
+ */
+int arena_reset( struct arena* arena, size_t size ) {
+	arena_release( arena );
+
+	if ( size <= arena->size ) {
+		/* Do not hold on to the memory of a much larger previous content */
+		if ( arena->touched > 2 * size ) {
+			trim_block( arena->base, arena->size, size );
+			arena->touched = size;
 		}
+		return 0;
 	}
-	memset( ( *display_buf ), 0, sizeof( wchar_t ) * ( *display_alloc ) );
 
-	/* Decode into wide-character string */
-	mbstate_t ps;
-	memset( &ps, 0, sizeof( ps ) );
-	char* output_start = output_buf;
-	( *display_len ) = mbsnrtowcs( ( *display_buf ), (const char** restrict) &output_start, output_len, ( *display_alloc ), &ps );
-	if ( ( *display_len ) == ( size_t ) -1 ) return;
+	/* Nothing needs to be preserved, so there is no point in copying with realloc() */
+	free_block( MEMORY_SNAPSHOTS, arena->base, arena->size );
+	arena->size = MAX( size, 2 * arena->size );
+	arena->touched = 0;
+	arena->base = alloc_block( MEMORY_SNAPSHOTS, arena->size );
+	if ( arena->base == NULL ) {
+		arena->size = 0;
+		return -1;
+	}
 
-	/* Split the result into lines */
-	wchar_t* line_start = *display_buf;
-	wchar_t* cur_pos = *display_buf;
+	return 0;
+}
 
-	while( 1 ) {
-		wchar_t c = *cur_pos;
-		if ( c == L'\n' || c == L'\0' ) {
-			const size_t line_len = cur_pos - line_start;
+/**
+ * Give all the memory of an arena's block back to the system, while keeping the block for later use.
+ */
+void arena_trim( struct arena* arena ) {
+	arena_release( arena );
+	arena->touched = 0;
+	trim_block( arena->base, arena->size, 0 );
+}
 
-			if ( line_len > ( *res_max_width ) ) {
-				( *res_max_width ) = line_len;
-			}
+/**
+ * Allocate size bytes from an arena for the given use.
+ *
+ * Returns NULL if the arena's block is full; it is never grown, since that would move the previous allocations.
+ */
+void* arena_alloc( struct arena* arena, enum memory_use use, size_t size ) {
+	size_t start = ( arena->used + ARENA_ALIGN - 1 ) & ~( (size_t) ARENA_ALIGN - 1 );
+	if ( start > arena->size || size > arena->size - start ) return NULL;
+
+	arena->used = start + size;
+	arena->allocated[use] += size;
+	account_memory( use, 0, size );
+	return arena->base + start;
+}
 
-			if ( c == L'\n' || line_len > 0 ) {
-				if ( ( *res_max_height ) + 1 > ( *lines_alloc ) ) {
-					( *lines ) = realloc( ( void* )( *lines ), sizeof( wchar_t* ) * ( ( *res_max_height ) + 1 ) );
-					( *lines_len ) = realloc( ( void* )( *lines_len ), sizeof( int* ) * ( ( *res_max_height ) + 1 ) );
-					( *lines_alloc ) = ( *res_max_height ) + 1;
-				}
+/* Sequence that restores the terminal after the direct renderer, and the original mode of the terminal */
+static char direct_restore[256];
+static size_t direct_restore_len = 0;
+static int direct_restore_fd = -1;
+static struct termios direct_termios;
 
-				( *lines )[*res_max_height] = line_start;
-				( *lines_len )[*res_max_height] = line_len;
-				( *res_max_height )++;
-			}
+/* Path of the control socket, to be removed on exit */
+static char* control_path = NULL;
 
-			if ( c == L'\0' ) {
-				break;
-			} else {
-				line_start = cur_pos + 1;
-			}
-		}
-		cur_pos++;
-	}
-}
+/* Names of the shared-memory exports, to be removed on exit */
+static char** shm_names = NULL;
+static int n_shm_names = 0;
 
 /**
  * Safely exit the program
  */
 void safe_exit( int status ) {
-	/* Reset ncurses */
-	if ( !isendwin() ) {
+	/* Reset ncurses, unless the direct renderer was used instead */
+	if ( stdscr != NULL && !isendwin() ) {
 		echo();
 		endwin();
 	}
 
+	/* Reset the terminal after the direct renderer */
+	if ( direct_restore_fd >= 0 ) {
+		if ( write( direct_restore_fd, direct_restore, direct_restore_len ) < 0 ) direct_restore_len = 0;
+		tcsetattr( STDIN_FILENO, TCSAFLUSH, &direct_termios );
+	}
+
+	/* Remove the control socket */
+	if ( control_path != NULL ) {
+		unlink( control_path );
+	}
+
+	if ( memory_report ) {
+		print_memory( STDERR_FILENO );
+	}
+
+	/* Remove the shared-memory exports */
+	for ( int i = 0; i < n_shm_names; i++ ) {
+		shm_unlink( shm_names[i] );
+	}
+
 	/* Finish execution */
 	exit( status );
 }
@@ -247,172 +774,3491 @@ void safe_parse_positive_timespec( char* str, struct timespec* res ) {
 		fprintf( stderr, "follow: argument value not positive '%s'\n", str );
 		exit( 2 );
 	}
-
-	res->tv_sec = (time_t) seconds;
-	res->tv_nsec = (long) ( ( seconds - res->tv_sec ) * 1000000000 );
+
+	res->tv_sec = (time_t) seconds;
+	res->tv_nsec = (long) ( ( seconds - res->tv_sec ) * 1000000000 );
+}
+
+/**
+ * Parse a string to a positive integer, checking for errors.
+ *
+ * If any error occurs, the program is aborted.
+ */
+void safe_parse_positive_long( char* str, long int* res ) {
+	if ( str == NULL || *str == '\0' ) {
+		fprintf( stderr, "follow: missing argument value\n" );
+		exit( 2 );
+	}
+
+	char* endptr = NULL;
+	long int value = strtol( str, &endptr, 10 );
+
+	if ( *endptr != '\0' ) {
+		fprintf( stderr, "follow: invalid argument value '%s'\n", str );
+		exit( 2 );
+	}
+
+	if ( value <= 0 ) {
+		fprintf( stderr, "follow: argument value not positive '%s'\n", str );
+		exit( 2 );
+	}
+
+	*res = value;
+}
+
+/**
+ * Parse a list of CPUs such as "0-3,6" to a CPU set, checking for errors.
+ *
+ * If any error occurs, the program is aborted.
+ */
+void safe_parse_cpu_list( char* str, cpu_set_t* cpus ) {
+	if ( str == NULL || *str == '\0' ) {
+		fprintf( stderr, "follow: missing argument value\n" );
+		exit( 2 );
+	}
+
+	CPU_ZERO( cpus );
+
+	char* pos = str;
+	for (;;) {
+		char* endptr = NULL;
+		long int first = strtol( pos, &endptr, 10 );
+		long int last = first;
+		if ( endptr != pos && *endptr == '-' ) {
+			pos = endptr + 1;
+			last = strtol( pos, &endptr, 10 );
+		}
+
+		if ( endptr == pos || first < 0 || last < first || last >= CPU_SETSIZE || ( *endptr != ',' && *endptr != '\0' ) ) {
+			fprintf( stderr, "follow: invalid CPU list '%s'\n", str );
+			exit( 2 );
+		}
+
+		for ( long int cpu = first; cpu <= last; cpu++ ) CPU_SET( cpu, cpus );
+
+		if ( *endptr == '\0' ) break;
+		pos = endptr + 1;
+	}
+}
+
+/**
+ * Parse the name of a scheduling policy, checking for errors.
+ *
+ * If any error occurs, the program is aborted.
+ */
+void safe_parse_policy( char* str, int* res ) {
+	if ( str == NULL || *str == '\0' ) {
+		fprintf( stderr, "follow: missing argument value\n" );
+		exit( 2 );
+	}
+
+	if ( strcmp( str, "other" ) == 0 ) {
+		*res = SCHED_OTHER;
+	} else if ( strcmp( str, "batch" ) == 0 ) {
+		*res = SCHED_BATCH;
+	} else if ( strcmp( str, "idle" ) == 0 ) {
+		*res = SCHED_IDLE;
+	} else {
+		fprintf( stderr, "follow: invalid scheduling policy '%s'\n", str );
+		exit( 2 );
+	}
+}
+
+/**
+ * Parse a nice value, from -20 to 19, checking for errors.
+ *
+ * If any error occurs, the program is aborted.
+ */
+void safe_parse_nice( char* str, long int* res ) {
+	if ( str == NULL || *str == '\0' ) {
+		fprintf( stderr, "follow: missing argument value\n" );
+		exit( 2 );
+	}
+
+	char* endptr = NULL;
+	long int value = strtol( str, &endptr, 10 );
+
+	if ( *endptr != '\0' ) {
+		fprintf( stderr, "follow: invalid argument value '%s'\n", str );
+		exit( 2 );
+	}
+
+	if ( value < -20 || value > 19 ) {
+		fprintf( stderr, "follow: nice value out of range '%s'\n", str );
+		exit( 2 );
+	}
+
+	*res = value;
+}
+
+/**
+ * Safely retrieve the value of the monotonic clock.
+ *
+ * The program is aborted if an error occurs.
+ */
+void safe_monotonic_clock( struct timespec* timer ) {
+	int res = clock_gettime( CLOCK_MONOTONIC, timer );
+
+	if ( res < 0 ) {
+		/* An error occurred, resert ncurses */
+		echo();
+		endwin();
+
+		/* Abort */
+		perror( "clock_gettime" );
+		exit( EXIT_FAILURE );
+	}
+}
+
+/**
+ * Add two timespec's in place
+ */
+void add_timespec( struct timespec* base, const struct timespec* add ) {
+	base->tv_sec += add->tv_sec;
+	base->tv_nsec += add->tv_nsec;
+
+	while ( base->tv_nsec >= 1000000000 ) {
+		base->tv_sec++;
+		base->tv_nsec -= 1000000000;
+	}
+}
+
+/**
+ * Compute the positive difference of two timespec's and return the results in the given 10th power of second
+ */
+long int diff_timespec( const struct timespec* left, const struct timespec* right, const int expo ) {
+	if ( left->tv_sec < right->tv_sec || ( left->tv_sec == right->tv_sec && left->tv_nsec <= right->tv_nsec ) ) return 0;
+
+	long int diff_sec = left->tv_sec - right->tv_sec;
+	long int diff_nsec;
+	if ( left->tv_nsec < right->tv_nsec ) {
+		diff_sec--;
+		diff_nsec = 1000000000 + left->tv_nsec - right->tv_nsec;
+	} else {
+		diff_nsec = left->tv_nsec - right->tv_nsec;
+	}
+
+	if ( expo <= 0 ) {
+		for ( int i = 0; i < -expo; i++ )  diff_sec /= 10;
+		return diff_sec;
+	} else {
+		for ( int i = 0; i < expo; i++ )  diff_sec *= 10;
+		for ( int i = 0; i < 9 - expo; i++ )  diff_nsec /= 10;
+		return diff_sec + diff_nsec;
+	}
+}
+
+/**
+ * Convert a multibyte string into a wide-character string, newly allocated with tracked_calloc() for the given use
+ */
+wchar_t* mbtowca( enum memory_use use, char* buf, size_t len ) {
+	mbstate_t ps;
+	memset( &ps, 0, sizeof( ps ) );
+
+	char* start = buf;
+	size_t wclen = mbsnrtowcs( NULL, (const char** restrict) &start, len, 0, &ps );
+	if ( wclen == ( size_t ) -1 ) return NULL;
+
+	wchar_t* ret = tracked_calloc( use, wclen + 1, sizeof( wchar_t ) );
+	if ( ret == NULL ) return NULL;
+
+	memset( &ps, 0, sizeof( ps ) );
+	start = buf;
+	wclen = mbsnrtowcs( ret, (const char** restrict) &start, len, wclen + 1, &ps );
+
+	if ( wclen == ( size_t ) -1 ) {
+		tracked_free( use, ret );
+		return NULL;
+	} else {
+		return ret;
+	}
+}
+
+/**
+ * Kinds of segments of a title line.
+ */
+enum title_field {
+	TITLE_TEXT, /* static text, including the hostname and the command */
+	TITLE_SEPARATOR, /* end of the left part and start of the right part */
+	TITLE_TIME, /* time at which the command was started */
+	TITLE_RUNTIME, /* time the command took, in seconds */
+	TITLE_EXIT, /* exit status of the command */
+	TITLE_BYTES, /* length of the output */
+	TITLE_LINES, /* number of lines of the output */
+	TITLE_INTERVAL /* refresh interval, in seconds */
+};
+
+/**
+ * Part of a compiled title format.
+ */
+struct title_segment {
+	enum title_field field;
+	size_t len;
+	wchar_t* text; /* only for TITLE_TEXT */
+};
+
+/**
+ * Compiled title format, along with the buffers in which the title is rendered.
+ *
+ * The static parts are converted to wide characters once, when compiling; rendering only formats the dynamic parts
+ * into buffers that are reused, so that it does not allocate memory once they are large enough.
+ */
+struct title {
+	int n_segments;
+	struct title_segment* segments;
+	size_t len[2];
+	size_t alloc[2];
+	wchar_t* buf[2]; /* left and right parts */
+	time_t time_sec; /* start time whose representation is in time_buf */
+	size_t time_len;
+	wchar_t time_buf[128];
+};
+
+/**
+ * Append a new segment to a title, converting its text to wide characters.
+ *
+ * Returns 0 on success and -1 if an error occurs.
+ */
+int add_title_segment( struct title* title, enum title_field field, char* text, size_t len ) {
+	/* Consecutive static texts are merged */
+	if ( field == TITLE_TEXT && title->n_segments > 0 && title->segments[title->n_segments - 1].field == TITLE_TEXT ) {
+		struct title_segment* last = &title->segments[title->n_segments - 1];
+		wchar_t* add = mbtowca( MEMORY_TITLES, text, len );
+		if ( add == NULL ) return -1;
+
+		size_t add_len = wcslen( add );
+		wchar_t* new = tracked_realloc( MEMORY_TITLES, ( void* ) last->text, sizeof( wchar_t ) * ( last->len + add_len + 1 ) );
+		if ( new == NULL ) {
+			tracked_free( MEMORY_TITLES, add );
+			return -1;
+		}
+		wmemcpy( new + last->len, add, add_len + 1 );
+		tracked_free( MEMORY_TITLES, add );
+
+		last->text = new;
+		last->len += add_len;
+		return 0;
+	}
+
+	struct title_segment* new = tracked_realloc( MEMORY_TITLES, ( void* ) title->segments, sizeof( struct title_segment ) * ( title->n_segments + 1 ) );
+	if ( new == NULL ) return -1;
+	title->segments = new;
+
+	struct title_segment* seg = &title->segments[title->n_segments];
+	seg->field = field;
+	seg->len = 0;
+	seg->text = NULL;
+
+	if ( field == TITLE_TEXT ) {
+		seg->text = mbtowca( MEMORY_TITLES, text, len );
+		if ( seg->text == NULL ) return -1;
+		seg->len = wcslen( seg->text );
+	}
+
+	title->n_segments++;
+	return 0;
+}
+
+/**
+ * Compile a title format for the given command.
+ *
+ * The format is made of text and the following sequences: %h (hostname), %c (command), %t (start time), %r (time
+ * the command took), %x (exit status), %b (length of the output), %l (number of lines), %n (refresh interval), %=
+ * (separation between the left part and the right part of the title) and %% (a percent sign).
+ *
+ * Returns 0 on success, and the offending character for an invalid sequence or -1 if an error occurs.
+ */
+int compile_title( struct title* title, const char* format, char* hostname, char* command ) {
+	memset( title, 0, sizeof( struct title ) );
+	title->time_sec = (time_t) -1;
+
+	const char* text = format;
+	for ( const char* pos = format; *pos != '\0'; pos++ ) {
+		if ( *pos != '%' ) continue;
+
+		if ( pos > text && add_title_segment( title, TITLE_TEXT, (char*) text, pos - text ) != 0 ) return -1;
+
+		int res;
+		pos++;
+		switch ( *pos ) {
+		case 'h':
+			res = add_title_segment( title, TITLE_TEXT, hostname, strlen( hostname ) );
+			break;
+		case 'c':
+			res = add_title_segment( title, TITLE_TEXT, command, strlen( command ) );
+			break;
+		case '%':
+			res = add_title_segment( title, TITLE_TEXT, "%", 1 );
+			break;
+		case '=':
+			res = add_title_segment( title, TITLE_SEPARATOR, NULL, 0 );
+			break;
+		case 't':
+			res = add_title_segment( title, TITLE_TIME, NULL, 0 );
+			break;
+		case 'r':
+			res = add_title_segment( title, TITLE_RUNTIME, NULL, 0 );
+			break;
+		case 'x':
+			res = add_title_segment( title, TITLE_EXIT, NULL, 0 );
+			break;
+		case 'b':
+			res = add_title_segment( title, TITLE_BYTES, NULL, 0 );
+			break;
+		case 'l':
+			res = add_title_segment( title, TITLE_LINES, NULL, 0 );
+			break;
+		case 'n':
+			res = add_title_segment( title, TITLE_INTERVAL, NULL, 0 );
+			break;
+		default:
+			return *pos == '\0' ? '%' : *pos;
+		}
+		if ( res != 0 ) return -1;
+
+		text = pos + 1;
+	}
+
+	if ( *text != '\0' && add_title_segment( title, TITLE_TEXT, (char*) text, strlen( text ) ) != 0 ) return -1;
+
+	return 0;
+}
+
+/**
+ * Append wide characters to one part of a rendered title.
+ */
+void append_title( struct title* title, int part, const wchar_t* text, size_t len ) {
+	if ( title->len[part] + len + 1 > title->alloc[part] ) {
+		size_t new_alloc = MAX( title->len[part] + len + 1, 2 * title->alloc[part] );
+		wchar_t* new = tracked_realloc( MEMORY_TITLES, ( void* ) title->buf[part], sizeof( wchar_t ) * new_alloc );
+		if ( new == NULL ) return;
+		title->buf[part] = new;
+		title->alloc[part] = new_alloc;
+	}
+
+	wmemcpy( title->buf[part] + title->len[part], text, len );
+	title->len[part] += len;
+	title->buf[part][title->len[part]] = L'\0';
+}
+
+/**
+ * Render a title with the values of the last execution.
+ */
+void render_title( struct title* title, const struct timespec* start_time, long int runtime, int exit_status, size_t bytes, int lines, const struct timespec* interval ) {
+	int part = 0;
+	title->len[0] = 0;
+	title->len[1] = 0;
+
+	for ( int s = 0; s < title->n_segments; s++ ) {
+		const struct title_segment* seg = &title->segments[s];
+		wchar_t buf[64];
+		int res = -1;
+
+		switch ( seg->field ) {
+		case TITLE_TEXT:
+			append_title( title, part, seg->text, seg->len );
+			break;
+		case TITLE_SEPARATOR:
+			part = 1;
+			break;
+		case TITLE_TIME:
+			/* The formatting depends on the locale and the time zone, but only changes every second */
+			if ( start_time->tv_sec != title->time_sec ) {
+				struct tm loct;
+				char mb_buf[128];
+				size_t mb_len = 0;
+				if ( localtime_r( &start_time->tv_sec, &loct ) != NULL ) {
+					mb_len = strftime( mb_buf, sizeof( mb_buf ), "%c", &loct );
+				}
+
+				mbstate_t ps;
+				memset( &ps, 0, sizeof( ps ) );
+				const char* mb_start = mb_buf;
+				title->time_len = mbsnrtowcs( title->time_buf, &mb_start, mb_len, sizeof( title->time_buf ) / sizeof( wchar_t ), &ps );
+				if ( title->time_len == ( size_t ) -1 ) title->time_len = 0;
+				title->time_sec = start_time->tv_sec;
+			}
+			append_title( title, part, title->time_buf, title->time_len );
+			break;
+		case TITLE_RUNTIME:
+			res = swprintf( buf, sizeof( buf ) / sizeof( wchar_t ), L"%ld.%03ld", runtime / 1000, runtime % 1000 );
+			break;
+		case TITLE_EXIT:
+			res = swprintf( buf, sizeof( buf ) / sizeof( wchar_t ), L"%d", exit_status );
+			break;
+		case TITLE_BYTES:
+			res = swprintf( buf, sizeof( buf ) / sizeof( wchar_t ), L"%zu", bytes );
+			break;
+		case TITLE_LINES:
+			res = swprintf( buf, sizeof( buf ) / sizeof( wchar_t ), L"%d", lines );
+			break;
+		case TITLE_INTERVAL:
+			res = swprintf( buf, sizeof( buf ) / sizeof( wchar_t ), L"%g", interval->tv_sec + interval->tv_nsec / 1e9 );
+			break;
+		}
+
+		if ( res > 0 ) append_title( title, part, buf, res );
+	}
+}
+
+/* Number of characters in a cell of a frame: a spacing one, and the combining ones that follow it */
+#define CELL_CHARS 3
+
+/**
+ * Cell of a frame composed without curses, which takes one column of the terminal.
+ *
+ * The second column of a double-width character is a cell without any character.
+ */
+struct cell {
+	wchar_t chars[CELL_CHARS]; /* padded with null characters */
+	attr_t attrs;
+};
+
+/**
+ * Frame composed without curses, for the direct renderer.
+ */
+struct frame {
+	int rows;
+	int cols;
+	struct cell* cells; /* one row after the other */
+};
+
+/**
+ * Where the frames are drawn: a window of curses, or a frame of the direct renderer if there is no window.
+ */
+struct screen {
+	WINDOW* win;
+	struct frame* frame;
+};
+
+/* Cell showing nothing, with the default attributes */
+static const struct cell blank_cell = { { L' ' }, 0 };
+
+/**
+ * Set a cell of a frame to a character of the given width, erasing the double-width characters it overlaps.
+ */
+void set_cell( struct frame* frame, int row, int col, wchar_t c, int width, attr_t attrs ) {
+	struct cell* cells = frame->cells + (size_t) row * frame->cols;
+
+	for ( int x = col; x < col + width; x++ ) {
+		if ( x > 0 && cells[x].chars[0] == L'\0' ) cells[x - 1] = blank_cell;
+		if ( x + 1 < frame->cols && cells[x + 1].chars[0] == L'\0' ) cells[x + 1] = blank_cell;
+	}
+
+	cells[col] = (struct cell) { { c }, attrs };
+	if ( width == 2 ) cells[col + 1] = (struct cell) { { L'\0' }, attrs };
+}
+
+/**
+ * Draw wide characters in a frame, as waddnwstr() does in a window: tabs move to the next multiple of 8 columns and
+ * other control characters are shown as ^X. The text is cut at the right edge rather than wrapped.
+ *
+ * Returns the column that follows the text.
+ */
+int put_frame( struct frame* frame, int row, int col, const wchar_t* text, int len, attr_t attrs ) {
+	if ( row < 0 || row >= frame->rows || col < 0 ) return col;
+	struct cell* cells = frame->cells + (size_t) row * frame->cols;
+
+	for ( int i = 0; i < len && col < frame->cols; i++ ) {
+		const wchar_t c = text[i];
+		if ( c == L'\t' ) {
+			do {
+				set_cell( frame, row, col++, L' ', 1, attrs );
+			} while ( col % 8 != 0 && col < frame->cols );
+		} else if ( c < 0x20 || c == 0x7f ) {
+			set_cell( frame, row, col++, L'^', 1, attrs );
+			if ( col < frame->cols ) set_cell( frame, row, col++, c ^ 0x40, 1, attrs );
+		} else {
+			int width = wcwidth( c );
+			if ( width == 0 ) {
+				/* A combining character goes with the one before it */
+				int x = col - 1;
+				if ( x > 0 && cells[x].chars[0] == L'\0' ) x--;
+				for ( int k = 1; x >= 0 && k < CELL_CHARS; k++ ) {
+					if ( cells[x].chars[k] == L'\0' ) {
+						cells[x].chars[k] = c;
+						break;
+					}
+				}
+			} else if ( width < 0 ) {
+				set_cell( frame, row, col++, MB_CUR_MAX > 1 ? L'\xfffd' : L'?', 1, attrs );
+			} else if ( col + width <= frame->cols ) {
+				set_cell( frame, row, col, c, width, attrs );
+				col += width;
+			} else {
+				break;
+			}
+		}
+	}
+
+	return col;
+}
+
+/**
+ * Erase the whole screen.
+ */
+void erase_screen( struct screen* screen ) {
+	if ( screen->win != NULL ) {
+		werase( screen->win );
+		return;
+	}
+
+	struct frame* frame = screen->frame;
+	for ( size_t i = 0; i < (size_t) frame->rows * frame->cols; i++ ) frame->cells[i] = blank_cell;
+}
+
+/**
+ * Draw wide characters on the screen with the given attributes.
+ *
+ * Returns the column that follows them.
+ */
+int put_screen( struct screen* screen, int row, int col, const wchar_t* text, int len, attr_t attrs ) {
+	if ( screen->win == NULL ) return put_frame( screen->frame, row, col, text, len, attrs );
+
+	wattron( screen->win, attrs );
+	mvwaddnwstr( screen->win, row, col, text, len );
+	wattroff( screen->win, attrs );
+	return getcurx( screen->win );
+}
+
+/**
+ * Draw at most len bytes of a multibyte string on the screen with the given attributes.
+ *
+ * Returns the column that follows it.
+ */
+int put_screen_str( struct screen* screen, int row, int col, const char* text, int len, attr_t attrs ) {
+	if ( screen->win != NULL ) {
+		wattron( screen->win, attrs );
+		mvwaddnstr( screen->win, row, col, text, len );
+		wattroff( screen->win, attrs );
+		return getcurx( screen->win );
+	}
+
+	mbstate_t ps;
+	memset( &ps, 0, sizeof( ps ) );
+	for ( int i = 0; i < len && text[i] != '\0'; ) {
+		wchar_t c;
+		size_t n = mbrtowc( &c, text + i, len - i, &ps );
+		if ( n == ( size_t ) -1 || n == ( size_t ) -2 ) {
+			c = MB_CUR_MAX > 1 ? L'\xfffd' : L'?';
+			n = 1;
+			memset( &ps, 0, sizeof( ps ) );
+		}
+		col = put_frame( screen->frame, row, col, &c, 1, attrs );
+		i += n;
+	}
+	return col;
+}
+
+/**
+ * Draw a horizontal line of n cells on the screen.
+ */
+void hline_screen( struct screen* screen, int row, int col, int n, attr_t attrs ) {
+	if ( screen->win != NULL ) {
+		wattron( screen->win, attrs );
+		mvwhline( screen->win, row, col, ACS_HLINE, n );
+		wattroff( screen->win, attrs );
+		return;
+	}
+
+	const wchar_t c = MB_CUR_MAX > 1 ? L'\x2500' : L'-';
+	for ( int i = 0; i < n; i++ ) put_frame( screen->frame, row, col + i, &c, 1, attrs );
+}
+
+/**
+ * Draw a vertical line of n cells on the screen.
+ */
+void vline_screen( struct screen* screen, int row, int col, int n, attr_t attrs ) {
+	if ( screen->win != NULL ) {
+		wattron( screen->win, attrs );
+		mvwvline( screen->win, row, col, ACS_VLINE, n );
+		wattroff( screen->win, attrs );
+		return;
+	}
+
+	const wchar_t c = MB_CUR_MAX > 1 ? L'\x2502' : L'|';
+	for ( int i = 0; i < n; i++ ) put_frame( screen->frame, row + i, col, &c, 1, attrs );
+}
+
+int show_title( struct screen* screen, int row, int screen_width, attr_t attrs, wchar_t* const display_title_left, size_t title_left_len, wchar_t* const display_title_right, size_t title_right_len ) {
+	const int title_height = 1;
+
+	const int right_start = screen_width - title_right_len;
+
+	if ( display_title_left != NULL ) {
+		if ( right_start > title_left_len ) {
+			put_screen( screen, row, 0, display_title_left, title_left_len, attrs );
+		} else if ( right_start > 4 ) {
+			const int col = put_screen( screen, row, 0, display_title_left, right_start - 4, attrs );
+			put_screen_str( screen, row, col, "...", 3, attrs );
+		}
+	}
+
+	if ( display_title_right != NULL ) {
+		if ( right_start >= 0 ) {
+			put_screen( screen, row, right_start, display_title_right, title_right_len, attrs );
+		} else {
+			put_screen( screen, row, 0, display_title_right - right_start, screen_width, attrs );
+		}
+	}
+
+	return title_height;
+}
+
+/**
+ * Decoded output of a command, split into lines.
+ *
+ * Snapshots are reference-counted, so that a result can be kept (e.g. as a pinned baseline) without copying it; a
+ * snapshot is only overwritten by a new result when nothing else holds it. All the data of a snapshot lives in its
+ * arena, which is reused by the next result stored in it.
+ */
+struct snapshot {
+	int refs;
+	unsigned long int generation;
+	struct arena arena;
+	size_t display_len;
+	wchar_t* display_buf;
+	int res_max_height;
+	int res_max_width;
+	wchar_t** lines;
+	int* lines_len;
+	int hashed;
+	uint64_t* lines_hash; /* only valid if hashed is set, see hash_lines() */
+};
+
+/* A retired snapshot, kept with its arena so that the next new one does not need to allocate */
+static struct snapshot* spare_snapshot = NULL;
+
+/* Generation of the last result stored in a snapshot */
+static unsigned long int snapshot_generation = 0;
+
+/**
+ * Create a new, empty snapshot with one reference.
+ *
+ * The program is aborted if an error occurs.
+ */
+struct snapshot* new_snapshot() {
+	struct snapshot* snap = spare_snapshot;
+
+	if ( snap != NULL ) {
+		spare_snapshot = NULL;
+	} else {
+		snap = tracked_calloc( MEMORY_SNAPSHOTS, 1, sizeof( struct snapshot ) );
+		if ( snap == NULL ) {
+			perror( "calloc" );
+			exit( EXIT_FAILURE );
+		}
+	}
+
+	snap->refs = 1;
+	snap->display_len = (size_t) -1;
+	snap->res_max_height = 0;
+	snap->res_max_width = 0;
+	snap->hashed = 0;
+
+	return snap;
+}
+
+/**
+ * Drop one reference to a snapshot, retiring it if it was the last one.
+ *
+ * A retired snapshot is kept as the spare if there is none yet, otherwise it is freed along with its arena. The memory
+ * of the spare's arena is given back to the system until it is used again.
+ */
+void release_snapshot( struct snapshot* snap ) {
+	if ( snap == NULL ) return;
+
+	snap->refs--;
+	if ( snap->refs > 0 ) return;
+
+	if ( spare_snapshot == NULL ) {
+		arena_trim( &snap->arena );
+		spare_snapshot = snap;
+		return;
+	}
+
+	arena_release( &snap->arena );
+	free_block( MEMORY_SNAPSHOTS, snap->arena.base, snap->arena.size );
+	tracked_free( MEMORY_SNAPSHOTS, snap );
+}
+
+/**
+ * Compute the hash of each line of a snapshot, unless already done.
+ *
+ * The hash is the 64-bit FNV-1a of the line's wide characters; it is never zero, so that zero can mark empty slots.
+ * Room for the hashes was already reserved by start_decoding().
+ */
+void hash_lines( struct snapshot* snap ) {
+	if ( snap->hashed ) return;
+
+	for ( int i = 0; i < snap->res_max_height; i++ ) {
+		uint64_t hash = UINT64_C( 14695981039346656037 );
+		const wchar_t* line = snap->lines[i];
+		for ( int c = 0; c < snap->lines_len[i]; c++ ) {
+			hash ^= (uint64_t) line[c];
+			hash *= UINT64_C( 1099511628211 );
+		}
+		snap->lines_hash[i] = hash == 0 ? 1 : hash;
+	}
+
+	snap->hashed = 1;
+}
+
+/* Bounds of the number of bytes given to each call to mbsnrtowcs() by decode_output() */
+#define DECODE_WINDOW_MIN 64
+#define DECODE_WINDOW_MAX 65536
+
+/* Number of bytes or characters processed at once when a conversion is spread over several iterations */
+#define DECODE_SLICE 262144
+
+/**
+ * Steps of the conversion of a command's output into a snapshot.
+ */
+enum conversion_phase {
+	COUNT_LINES,
+	DECODE,
+	SPLIT_LINES,
+	CONVERTED,
+};
+
+/**
+ * State of the conversion of the raw output of a command into a snapshot, which can be done in several slices.
+ *
+ * The output must not change until the conversion is complete.
+ */
+struct conversion {
+	enum conversion_phase phase;
+	const char* buf;
+	size_t len;
+	struct snapshot* snap;
+	size_t n_lines; /* room in the line index */
+
+	/* Position in the raw output; see decode_output() for the others */
+	const char* pos;
+	const char* nul;
+	size_t window;
+	mbstate_t ps;
+
+	/* Position in the decoded output */
+	size_t n_chars;
+	size_t split_pos;
+	size_t line_start;
+};
+
+/**
+ * Decode up to max_bytes more bytes of the raw output into wide characters.
+ *
+ * Invalid or truncated sequences and NUL bytes, at which mbsnrtowcs() fails or stops, are each replaced by a
+ * replacement character and the conversion resumes after them, so that the rest of the output is still shown.
+ *
+ * Since mbsnrtowcs() may look at all the bytes it is given at each call, it is given a window that starts small after
+ * an invalid sequence and grows while the input is valid; the time taken is thus linear whatever the input.
+ */
+void decode_output( struct conversion* conv, size_t max_bytes ) {
+	const wchar_t replacement = MB_CUR_MAX > 1 ? L'\xfffd' : L'?';
+	const char* end = conv->buf + conv->len;
+	const char* slice_end = conv->pos + MIN( max_bytes, (size_t) ( end - conv->pos ) );
+	wchar_t* dst = conv->snap->display_buf;
+
+	while ( conv->pos < slice_end ) {
+		/* Only convert up to the next NUL byte, since the conversion would stop there */
+		if ( conv->nul == NULL || conv->nul < conv->pos ) {
+			conv->nul = memchr( conv->pos, '\0', end - conv->pos );
+			if ( conv->nul == NULL ) conv->nul = end;
+		}
+
+		const size_t n_bytes = MIN( (size_t) ( conv->nul - conv->pos ), conv->window );
+		const mbstate_t start_ps = conv->ps;
+		const char* src = conv->pos;
+		size_t res = n_bytes == 0 ? 0 : mbsnrtowcs( dst + conv->n_chars, &src, n_bytes, conv->len - conv->n_chars, &conv->ps );
+
+		if ( res == ( size_t ) -1 ) {
+			/* src points to the invalid sequence; the characters before it were written, count them */
+			const char* valid = conv->pos;
+			mbstate_t count_ps = start_ps;
+			res = mbsnrtowcs( NULL, &valid, src - conv->pos, 0, &count_ps );
+			if ( res != ( size_t ) -1 ) conv->n_chars += res;
+
+			/* The invalid sequence may be the end of the previous window, left in the state, rather than this byte */
+			dst[conv->n_chars++] = replacement;
+			memset( &conv->ps, 0, sizeof( conv->ps ) );
+			conv->pos = ( src == conv->pos && !mbsinit( &start_ps ) ) ? src : src + 1;
+			conv->window = DECODE_WINDOW_MIN;
+			continue;
+		}
+
+		conv->n_chars += res;
+		conv->pos += n_bytes;
+		conv->window = MIN( 2 * conv->window, DECODE_WINDOW_MAX );
+
+		if ( conv->pos == conv->nul ) {
+			/* A sequence cut by a NUL byte or the end of the output is left in the state */
+			if ( !mbsinit( &conv->ps ) ) {
+				dst[conv->n_chars++] = replacement;
+				memset( &conv->ps, 0, sizeof( conv->ps ) );
+			}
+
+			if ( conv->nul < end ) {
+				dst[conv->n_chars++] = replacement;
+				conv->pos++;
+			}
+		}
+	}
+}
+
+/**
+ * Start the conversion of a raw output into the given snapshot.
+ *
+ * The conversion is then made by calls to continue_conversion(). If output_len is (size_t) -1, the snapshot is left
+ * empty.
+ */
+void begin_conversion( struct conversion* conv, const char* output_buf, size_t output_len, struct snapshot* snap ) {
+	memset( conv, 0, sizeof( struct conversion ) );
+	conv->phase = output_len == ( size_t ) -1 ? CONVERTED : COUNT_LINES;
+	conv->buf = output_buf;
+	conv->len = output_len;
+	conv->snap = snap;
+	conv->n_lines = 1;
+	conv->pos = output_buf;
+
+	snap->display_len = ( size_t ) -1;
+	snap->res_max_height = 0;
+	snap->res_max_width = 0;
+
+	if ( output_len != ( size_t ) -1 ) PROBE1( decode_start, output_len );
+}
+
+/**
+ * Allocate the decoded output, the line index and room for the hash of each line from the snapshot's arena, then
+ * start decoding.
+ *
+ * Returns 0 on success, or -1 if the arena could not be allocated, in which case the conversion is over.
+ */
+int start_decoding( struct conversion* conv ) {
+	struct snapshot* snap = conv->snap;
+
+	/* Each of the four allocations may need up to ARENA_ALIGN bytes of padding, once */
+	const size_t per_line = sizeof( wchar_t* ) + sizeof( int ) + sizeof( uint64_t );
+	if ( arena_reset( &snap->arena, sizeof( wchar_t ) * ( conv->len + 1 ) + conv->n_lines * per_line + 4 * ARENA_ALIGN ) < 0 ) {
+		conv->phase = CONVERTED;
+		return -1;
+	}
+
+	snap->display_buf = arena_alloc( &snap->arena, MEMORY_TEXT, sizeof( wchar_t ) * ( conv->len + 1 ) );
+	snap->lines = arena_alloc( &snap->arena, MEMORY_LINES, sizeof( wchar_t* ) * conv->n_lines );
+	snap->lines_len = arena_alloc( &snap->arena, MEMORY_LINES, sizeof( int ) * conv->n_lines );
+	snap->lines_hash = arena_alloc( &snap->arena, MEMORY_LINES, sizeof( uint64_t ) * conv->n_lines );
+	snap->res_max_height = 0;
+	snap->res_max_width = 0;
+
+	conv->phase = DECODE;
+	conv->pos = conv->buf;
+	conv->nul = NULL;
+	conv->window = DECODE_WINDOW_MIN;
+	memset( &conv->ps, 0, sizeof( conv->ps ) );
+	conv->n_chars = 0;
+
+	return 0;
+}
+
+/**
+ * Continue the conversion of a raw output into an array of lines, while counting its width and height, by processing
+ * about max_bytes more bytes or characters.
+ *
+ * Returns 1 once the conversion is complete, and 0 otherwise. If the snapshot could not be allocated, its display_len
+ * is (size_t) -1 at the end.
+ */
+int continue_conversion( struct conversion* conv, size_t max_bytes ) {
+	struct snapshot* snap = conv->snap;
+	const char* end = conv->buf + conv->len;
+
+	if ( conv->phase == COUNT_LINES ) {
+		/* A line feed byte is always a line feed in the encodings that matter, so counting them gives the number of lines */
+		const char* stop = conv->pos + MIN( max_bytes, (size_t) ( end - conv->pos ) );
+		for ( const char* pos = conv->pos; ( pos = memchr( pos, '\n', stop - pos ) ) != NULL; pos++ ) {
+			conv->n_lines++;
+		}
+		conv->pos = stop;
+
+		if ( stop < end ) return 0;
+		return start_decoding( conv ) < 0;
+	}
+
+	if ( conv->phase == DECODE ) {
+		decode_output( conv, max_bytes );
+		if ( conv->pos < end ) return 0;
+
+		/* The decoded output has no NUL character but the terminating one */
+		snap->display_buf[conv->n_chars] = L'\0';
+		conv->phase = SPLIT_LINES;
+		conv->split_pos = 0;
+		conv->line_start = 0;
+		return 0;
+	}
+
+	if ( conv->phase == SPLIT_LINES ) {
+		wchar_t* chars = snap->display_buf;
+		const size_t stop = MIN( conv->n_chars, conv->split_pos + max_bytes );
+
+		for (;;) {
+			const wchar_t* lf = wmemchr( chars + conv->split_pos, L'\n', stop - conv->split_pos );
+			if ( lf == NULL && stop < conv->n_chars ) {
+				/* The current line continues in the next slice */
+				conv->split_pos = stop;
+				return 0;
+			}
+
+			/* A line ends at a line feed, or at the end of the output unless it is empty */
+			const size_t line_end = lf != NULL ? (size_t) ( lf - chars ) : stop;
+			const size_t line_len = line_end - conv->line_start;
+			if ( line_len > snap->res_max_width ) {
+				snap->res_max_width = line_len;
+			}
+
+			if ( lf != NULL || line_len > 0 ) {
+				if ( snap->res_max_height + 1 > conv->n_lines ) {
+					/* Some exotic encoding hid line feeds in multi-byte sequences; start again with a bound that always holds */
+					conv->n_lines = conv->n_chars + 1;
+					return start_decoding( conv ) < 0;
+				}
+
+				snap->lines[snap->res_max_height] = chars + conv->line_start;
+				snap->lines_len[snap->res_max_height] = line_len;
+				snap->res_max_height++;
+			}
+
+			if ( lf == NULL ) break;
+			conv->line_start = line_end + 1;
+			conv->split_pos = line_end + 1;
+		}
+
+		snap->display_len = conv->n_chars;
+		conv->phase = CONVERTED;
+		PROBE2( decode_end, snap->display_len, snap->res_max_height );
+	}
+
+	return 1;
+}
+
+/**
+ * Convert the raw output from a command into an array of lines, all at once.
+ */
+void convert_output( const char* output_buf, size_t output_len, struct snapshot* snap ) {
+	struct conversion conv;
+	begin_conversion( &conv, output_buf, output_len, snap );
+	while ( !continue_conversion( &conv, SIZE_MAX ) );
+}
+
+/**
+ * Open-addressing hash table from line hashes to an integer.
+ */
+struct line_table {
+	size_t mask;
+	uint64_t* keys;
+	int* values;
+};
+
+/**
+ * Empty the table and make room for at least the given number of entries.
+ *
+ * Returns 0 on success and -1 if an error occurs.
+ */
+int clear_line_table( struct line_table* table, size_t n ) {
+	size_t size = 16;
+	while ( size < 2 * n ) size *= 2;
+
+	if ( size > table->mask + 1 || table->keys == NULL ) {
+		uint64_t* keys = tracked_realloc( MEMORY_CACHES, ( void* ) table->keys, sizeof( uint64_t ) * size );
+		if ( keys == NULL ) return -1;
+		table->keys = keys;
+
+		int* values = tracked_realloc( MEMORY_CACHES, ( void* ) table->values, sizeof( int ) * size );
+		if ( values == NULL ) return -1;
+		table->values = values;
+
+		table->mask = size - 1;
+	}
+
+	memset( table->keys, 0, sizeof( uint64_t ) * ( table->mask + 1 ) );
+
+	return 0;
+}
+
+/**
+ * Look up the value associated with a line hash.
+ *
+ * If the hash is not in the table, it is added with a zero value if insert is set; otherwise NULL is returned.
+ */
+int* line_table_get( struct line_table* table, uint64_t hash, int insert ) {
+	for ( size_t slot = hash & table->mask;; slot = ( slot + 1 ) & table->mask ) {
+		if ( table->keys[slot] == hash ) return &table->values[slot];
+		if ( table->keys[slot] == 0 ) {
+			if ( !insert ) return NULL;
+			table->keys[slot] = hash;
+			table->values[slot] = 0;
+			return &table->values[slot];
+		}
+	}
+}
+
+/* Identification of the shared-memory export, "FLW1" */
+#define SHM_MAGIC UINT32_C( 0x31574c46 )
+#define SHM_VERSION 1
+
+/**
+ * Header of the shared-memory export of a pane's results, which is followed by the raw output of the command.
+ *
+ * The header is a sequence lock: sequence is odd while a new result is being written. Readers load sequence
+ * (acquire), skip if it is odd, read the fields and the output in place, then check that sequence did not change
+ * (after an acquire fence); otherwise, they try again. The region only ever grows; readers that mapped fewer than
+ * capacity bytes after the header need to map it again.
+ */
+struct shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sequence;
+	uint64_t generation; /* number of results published so far */
+	uint64_t capacity; /* size of the area after the header */
+	uint64_t length; /* length of the output */
+	int64_t timestamp; /* wall-clock time at which the command was started, in nanoseconds since the epoch */
+	int32_t exit_status; /* exit status of the command, or 128 plus the signal number if it was killed */
+	int32_t error; /* errno value if the command could not be executed or read */
+};
+
+/**
+ * Shared-memory region in which a pane's results are published.
+ */
+struct shm_export {
+	char* name;
+	int fd;
+	size_t size;
+	struct shm_header* header;
+};
+
+/**
+ * Create the shared-memory region with the given name.
+ *
+ * If any error occurs, the program is aborted.
+ */
+struct shm_export* open_shm_export( char* name ) {
+	struct shm_export* shm = calloc( 1, sizeof( struct shm_export ) );
+	char** new = realloc( ( void* ) shm_names, sizeof( char* ) * ( n_shm_names + 1 ) );
+	if ( shm == NULL || new == NULL ) {
+		perror( "malloc" );
+		exit( EXIT_FAILURE );
+	}
+	shm_names = new;
+
+	shm->name = name;
+	shm->fd = shm_open( name, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+	if ( shm->fd < 0 ) {
+		fprintf( stderr, "follow: %s: %s\n", name, strerror( errno ) );
+		exit( EXIT_FAILURE );
+	}
+	fcntl( shm->fd, F_SETFD, FD_CLOEXEC );
+
+	shm->size = sysconf( _SC_PAGESIZE );
+	if ( ftruncate( shm->fd, shm->size ) < 0 ) {
+		fprintf( stderr, "follow: %s: %s\n", name, strerror( errno ) );
+		exit( EXIT_FAILURE );
+	}
+
+	shm->header = mmap( NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0 );
+	if ( shm->header == MAP_FAILED ) {
+		fprintf( stderr, "follow: %s: %s\n", name, strerror( errno ) );
+		exit( EXIT_FAILURE );
+	}
+	account_memory( MEMORY_EXPORTS, 0, shm->size );
+
+	shm->header->magic = SHM_MAGIC;
+	shm->header->version = SHM_VERSION;
+	shm->header->capacity = shm->size - sizeof( struct shm_header );
+
+	shm_names[n_shm_names++] = name;
+
+	return shm;
+}
+
+/**
+ * Publish a new result into the shared-memory region.
+ *
+ * If the region cannot be grown to hold the output, only the header is updated, with error set to ENOMEM.
+ */
+void publish_shm( struct shm_export* shm, const char* buf, size_t len, const struct timespec* start_time, int exit_status, int error ) {
+	struct shm_header* header = shm->header;
+
+	/* Enter the write section */
+	const uint64_t sequence = __atomic_load_n( &header->sequence, __ATOMIC_RELAXED );
+	__atomic_store_n( &header->sequence, sequence + 1, __ATOMIC_RELAXED );
+	__atomic_thread_fence( __ATOMIC_RELEASE );
+
+	if ( error == 0 && sizeof( struct shm_header ) + len > shm->size ) {
+		/* Grow to the next multiple of the page size, with some margin for the output to grow further */
+		const size_t page = sysconf( _SC_PAGESIZE );
+		size_t new_size = sizeof( struct shm_header ) + len + len / 4;
+		new_size = ( new_size + page - 1 ) / page * page;
+
+		void* new = MAP_FAILED;
+		if ( ftruncate( shm->fd, new_size ) == 0 ) {
+			new = mremap( ( void* ) header, shm->size, new_size, MREMAP_MAYMOVE );
+		}
+
+		if ( new == MAP_FAILED ) {
+			error = ENOMEM;
+		} else {
+			header = shm->header = new;
+			account_memory( MEMORY_EXPORTS, shm->size, new_size );
+			shm->size = new_size;
+			header->capacity = new_size - sizeof( struct shm_header );
+		}
+	}
+
+	if ( error == 0 ) {
+		memcpy( ( char* )( header + 1 ), buf, len );
+	}
+	header->generation++;
+	header->length = error == 0 ? len : 0;
+	header->timestamp = (int64_t) start_time->tv_sec * 1000000000 + start_time->tv_nsec;
+	header->exit_status = exit_status;
+	header->error = error;
+
+	/* Leave the write section */
+	__atomic_store_n( &header->sequence, sequence + 2, __ATOMIC_RELEASE );
+}
+
+/* Number of variables added to the environment of the commands, and size of the buffer of each */
+#define RUN_ENV_VARS 4
+#define RUN_ENV_LEN 48
+
+/**
+ * Environment of the commands, which describes their previous execution.
+ *
+ * The array of variables is built once; each run only rewrites the values of the variables added by follow, which
+ * are stored in fixed-size buffers allocated after the array. They are not stored in the structure itself, so that
+ * moving it, as happens to the panes, does not leave the array pointing to the old place.
+ */
+struct run_env {
+	char** envp;
+	char** vars; /* start of the variables added by follow within envp */
+	char* iteration;
+	char* prev_start;
+	char* prev_exit;
+	char* prev_hash;
+};
+
+/**
+ * Build the environment of the commands from the current one.
+ *
+ * The program is aborted if an error occurs.
+ */
+void init_run_env( struct run_env* env ) {
+	extern char** environ;
+
+	size_t n_vars = 0;
+	while ( environ[n_vars] != NULL ) n_vars++;
+
+	const size_t array_size = sizeof( char* ) * ( n_vars + RUN_ENV_VARS + 1 );
+	env->envp = malloc( array_size + RUN_ENV_VARS * RUN_ENV_LEN );
+	if ( env->envp == NULL ) {
+		perror( "malloc" );
+		exit( EXIT_FAILURE );
+	}
+
+	char* values = (char*) env->envp + array_size;
+	env->iteration = values;
+	env->prev_start = values + RUN_ENV_LEN;
+	env->prev_exit = values + 2 * RUN_ENV_LEN;
+	env->prev_hash = values + 3 * RUN_ENV_LEN;
+
+	/* Variables of an enclosing follow are overridden */
+	size_t n_env = 0;
+	for ( size_t i = 0; i < n_vars; i++ ) {
+		if ( strncmp( environ[i], "FOLLOW_ITERATION=", 17 ) == 0 || strncmp( environ[i], "FOLLOW_PREV_", 12 ) == 0 ) continue;
+		env->envp[n_env++] = environ[i];
+	}
+
+	/* FOLLOW_ITERATION comes first, so that the other ones can be left out for the first execution */
+	env->vars = env->envp + n_env;
+	env->vars[0] = env->iteration;
+	env->vars[1] = env->prev_start;
+	env->vars[2] = env->prev_exit;
+	env->vars[3] = env->prev_hash;
+	env->vars[RUN_ENV_VARS] = NULL;
+}
+
+/**
+ * Update the variables describing the previous execution of the commands.
+ */
+void update_run_env( struct run_env* env, unsigned long int iteration, const struct timespec* prev_start, int prev_exit, uint64_t prev_hash ) {
+	snprintf( env->iteration, RUN_ENV_LEN, "FOLLOW_ITERATION=%lu", iteration );
+
+	if ( iteration > 1 ) {
+		snprintf( env->prev_start, RUN_ENV_LEN, "FOLLOW_PREV_START=%lld", (long long int) prev_start->tv_sec * 1000000000 + prev_start->tv_nsec );
+		snprintf( env->prev_exit, RUN_ENV_LEN, "FOLLOW_PREV_EXIT=%d", prev_exit );
+		snprintf( env->prev_hash, RUN_ENV_LEN, "FOLLOW_PREV_HASH=%016llx", (unsigned long long int) prev_hash );
+		env->vars[1] = env->prev_start;
+	} else {
+		env->vars[1] = NULL;
+	}
+}
+
+/**
+ * Continue a 64-bit FNV-1a hash with the bytes of a buffer.
+ */
+uint64_t hash_more( uint64_t hash, const char* buf, size_t len ) {
+	for ( size_t i = 0; i < len; i++ ) {
+		hash ^= (unsigned char) buf[i];
+		hash *= UINT64_C( 1099511628211 );
+	}
+	return hash;
+}
+
+/**
+ * Compute the 64-bit FNV-1a hash of a buffer.
+ */
+uint64_t hash_bytes( const char* buf, size_t len ) {
+	return hash_more( UINT64_C( 14695981039346656037 ), buf, len );
+}
+
+/**
+ * One execution of a command and the output it produced so far.
+ */
+struct job {
+	/* Command to execute */
+	char* label;
+	char** command_args;
+
+	/* Current execution */
+	int pending;
+	pid_t cmd_pid;
+	int cmd_fd;
+	struct timespec start_timer;
+	long int runtime; /* in milliseconds */
+	int exit_status;
+	int output_memfd; /* memory file holding the output with --previous-fd, or -1 if it is on the heap */
+	int output_err;
+	size_t output_len;
+	size_t output_alloc;
+	char* output_buf;
+};
+
+/**
+ * Statistics of one numeric field over the samples taken since the last repaint.
+ */
+struct field_stats {
+	double min;
+	double max;
+	double sum;
+	unsigned long int count;
+	int decimals; /* largest number of decimals seen, used to print the statistics */
+};
+
+/**
+ * Aggregation of the samples of an oversampling pane (--oversample).
+ *
+ * The command runs at the sample interval, while the result is only repainted at the pane's interval. The fields are
+ * the numbers of the output, matched by their position; the memory used only depends on the size of the output.
+ */
+struct oversample {
+	struct timespec interval; /* between samples, zero if the pane does not oversample */
+	struct timespec next_display;
+	unsigned long int n_samples;
+	size_t n_fields;
+	size_t fields_alloc;
+	struct field_stats* fields;
+	size_t text_alloc;
+	char* text; /* the last sample, with each field replaced by its statistics */
+};
+
+/**
+ * Find the next number in buf, starting at *pos.
+ *
+ * A number is a run of digits with an optional sign and decimal part that is not part of a word, such as "eth0", or of
+ * a longer dotted sequence. Returns 1 and sets start, end, value and decimals if one was found, 0 otherwise.
+ */
+int next_number( const char* buf, size_t len, size_t* pos, size_t* start, size_t* end, double* value, int* decimals ) {
+	for ( size_t i = ( *pos ); i < len; i++ ) {
+		const char c = buf[i];
+		const int neg = c == '-';
+		if ( !( c >= '0' && c <= '9' ) && !( neg && i + 1 < len && buf[i + 1] >= '0' && buf[i + 1] <= '9' ) ) continue;
+
+		if ( i > 0 ) {
+			const char prev = buf[i - 1];
+			if ( ( prev >= '0' && prev <= '9' ) || ( prev >= 'a' && prev <= 'z' ) || ( prev >= 'A' && prev <= 'Z' ) || prev == '_' || prev == '.' ) continue;
+		}
+
+		/* Integer part, then the decimals if the dot is followed by a digit */
+		size_t j = i + neg;
+		double v = 0.;
+		int n_digits = 0;
+		for ( ; j < len && buf[j] >= '0' && buf[j] <= '9'; j++, n_digits++ ) v = 10. * v + ( buf[j] - '0' );
+
+		int n_dec = 0;
+		if ( j + 1 < len && buf[j] == '.' && buf[j + 1] >= '0' && buf[j + 1] <= '9' ) {
+			double scale = 1.;
+			for ( j++; j < len && buf[j] >= '0' && buf[j] <= '9'; j++, n_dec++ ) {
+				scale /= 10.;
+				v += scale * ( buf[j] - '0' );
+			}
+		}
+
+		( *pos ) = j;
+
+		/* Identifiers and dotted sequences (e.g. "1.2.3") are not measurements; neither are overly long digit strings */
+		if ( j < len && ( buf[j] == '.' || buf[j] == '_' ) && j + 1 < len && buf[j + 1] >= '0' && buf[j + 1] <= '9' ) {
+			while ( ( *pos ) < len && ( buf[*pos] == '.' || ( buf[*pos] >= '0' && buf[*pos] <= '9' ) ) ) ( *pos )++;
+			i = ( *pos ) - 1;
+			continue;
+		}
+		if ( n_digits > 15 || n_dec > 9 ) {
+			i = j - 1;
+			continue;
+		}
+
+		( *start ) = i;
+		( *end ) = j;
+		( *value ) = neg ? -v : v;
+		( *decimals ) = n_dec;
+		return 1;
+	}
+
+	( *pos ) = len;
+	return 0;
+}
+
+/**
+ * Add the numbers of a sample to the statistics of the fields.
+ *
+ * Fields beyond the end of the array are dropped if it cannot be grown.
+ */
+void add_sample( struct oversample* samples, const char* buf, size_t len ) {
+	size_t pos = 0, start, end;
+	size_t field = 0;
+	double value;
+	int decimals;
+
+	while ( next_number( buf, len, &pos, &start, &end, &value, &decimals ) ) {
+		if ( field >= samples->fields_alloc ) {
+			size_t new_alloc = MAX( 64, 2 * samples->fields_alloc );
+			struct field_stats* new = tracked_realloc( MEMORY_SAMPLES, ( void* ) samples->fields, sizeof( struct field_stats ) * new_alloc );
+			if ( new == NULL ) break;
+			samples->fields = new;
+			samples->fields_alloc = new_alloc;
+		}
+
+		if ( field >= samples->n_fields ) {
+			memset( samples->fields + samples->n_fields, 0, sizeof( struct field_stats ) * ( field + 1 - samples->n_fields ) );
+			samples->n_fields = field + 1;
+		}
+
+		struct field_stats* stats = &samples->fields[field];
+		if ( stats->count == 0 || value < stats->min ) stats->min = value;
+		if ( stats->count == 0 || value > stats->max ) stats->max = value;
+		stats->sum += value;
+		stats->count++;
+		stats->decimals = MAX( stats->decimals, decimals );
+
+		field++;
+	}
+
+	samples->n_samples++;
+}
+
+/**
+ * Write the last sample to the text buffer, with each field that varied replaced by "min/avg/max", and start a new
+ * aggregation.
+ *
+ * Returns the length of the text, or (size_t) -1 if the buffer could not be allocated.
+ */
+size_t render_samples( struct oversample* samples, const char* buf, size_t len ) {
+	size_t pos = 0, start, end, copied = 0, text_len = 0;
+	size_t field = 0;
+	double value;
+	int decimals;
+
+	for ( int done = 0; !done; ) {
+		char stats_buf[128];
+		size_t stats_len = 0;
+
+		if ( !next_number( buf, len, &pos, &start, &end, &value, &decimals ) ) {
+			start = len;
+			end = len;
+			done = 1;
+		} else if ( field < samples->n_fields && samples->fields[field].count > 0 ) {
+			const struct field_stats* stats = &samples->fields[field];
+			if ( stats->min != stats->max ) {
+				const double avg = stats->sum / stats->count;
+				int res = snprintf( stats_buf, sizeof( stats_buf ), "%.*f/%.*f/%.*f", stats->decimals, stats->min, stats->decimals + 1, avg, stats->decimals, stats->max );
+				if ( res > 0 && res < sizeof( stats_buf ) ) stats_len = res;
+			}
+			field++;
+		} else {
+			field++;
+		}
+
+		/* Fields that did not vary are kept as they are */
+		if ( stats_len == 0 ) end = start;
+
+		const size_t needed = text_len + ( start - copied ) + stats_len + 1;
+		if ( needed > samples->text_alloc ) {
+			size_t new_alloc = MAX( needed, 2 * samples->text_alloc );
+			char* new = tracked_realloc( MEMORY_SAMPLES, ( void* ) samples->text, new_alloc );
+			if ( new == NULL ) return ( size_t ) -1;
+			samples->text = new;
+			samples->text_alloc = new_alloc;
+		}
+
+		memcpy( samples->text + text_len, buf + copied, start - copied );
+		text_len += start - copied;
+		memcpy( samples->text + text_len, stats_buf, stats_len );
+		text_len += stats_len;
+		copied = stats_len > 0 ? end : start;
+	}
+
+	samples->text[text_len] = '\0';
+
+	/* The memory is kept for the next aggregation */
+	samples->n_fields = 0;
+	samples->n_samples = 0;
+
+	return text_len;
+}
+
+/* Number of marks of a pane, one per lowercase letter */
+#define N_MARKS 26
+
+/**
+ * Mark set on a line of a pane's result, found again in the following results by the content of that line.
+ */
+struct mark {
+	uint64_t hash; /* hash of the marked line, zero if the mark is not set */
+	uint64_t context; /* hash of the line before it, zero if it was the first line */
+	int line; /* position in the last result in which it was found */
+	int lost; /* set if the line is not in the current result */
+};
+
+/**
+ * Part of a result that is shown.
+ */
+struct viewport {
+	int v_offset;
+	int h_offset;
+	int v_end;
+};
+
+/**
+ * State of one followed command: its execution, its latest result and the part of it that is shown.
+ *
+ * In the default mode there is a single pane; the dashboard mode (--pane, --config) creates one per command.
+ * A pane usually executes a single job; with --each, the jobs of all the arguments are shown one after the other.
+ */
+struct pane {
+	/* Commands to execute */
+	char* name;
+	int n_jobs;
+	struct job* jobs;
+	struct timespec interval;
+	int show_runtime;
+
+	/* Current execution */
+	int refresh;
+	int paused; /* when set, the command is only executed on request */
+	unsigned long int iterations;
+	struct timespec start_time; /* wall-clock time at which the current execution started */
+	struct run_env env;
+	int previous_fd; /* file descriptor on which the commands get their previous output, or -1 */
+	const struct placement* placement; /* of the commands */
+	int running; /* number of jobs that are pending or executing */
+	struct timespec next_timer;
+	size_t output_alloc;
+	char* output_buf; /* concatenation of the jobs' outputs, if there are several of them */
+	struct oversample samples;
+	long int decode_budget; /* when positive, the result is converted in slices between keys */
+	int converting; /* whether conv holds a conversion in progress */
+	struct conversion conv;
+
+	/* Result of the last completed execution */
+	struct title title;
+	int display_err;
+	int exit_status;
+	size_t output_len;
+	struct snapshot* snap;
+
+	/* Last completed execution, even if its output was not displayed, for the environment of the next one */
+	int last_exit;
+	uint64_t last_hash;
+
+	/* Export of the results to shared memory */
+	struct shm_export* shm;
+
+	/* Comparison with a pinned result */
+	int pin_baseline; /* whether the next result is pinned as the baseline, see --baseline */
+	struct snapshot* baseline;
+	int side_by_side;
+	unsigned long int diff_generation;
+	unsigned long int diff_base_generation;
+	size_t diff_alloc;
+	char* diff_snap; /* for each line of the result, whether it was added since the baseline */
+	size_t diff_base_alloc;
+	char* diff_base; /* for each line of the baseline, whether it was removed from the result */
+	size_t diff_rows_alloc;
+	int* diff_rows; /* rows of the inline comparison: a line of the result, or -1 - n for line n of the baseline */
+	int diff_n_rows;
+	size_t diff_trace_alloc;
+	int* diff_trace; /* furthest points reached by diff_lines() after each number of edits */
+	int diff_added;
+	int diff_removed;
+
+	/* Marks, found again in each new result */
+	struct mark marks[N_MARKS];
+	unsigned long int marks_generation;
+	struct line_table marks_table;
+
+	/* Viewports; when the pane is split, both show the same result */
+	int n_views;
+	int view; /* the one that receives the keys */
+	int split_height; /* height of the first viewport when split */
+	struct viewport views[2];
+};
+
+/**
+ * Build the arguments to execute a command string through the user's shell.
+ */
+char** shell_command_args( char* command ) {
+	char** command_args = malloc( sizeof( char* ) * 4 );
+	if ( command_args == NULL ) {
+		perror( "malloc" );
+		exit( EXIT_FAILURE );
+	}
+
+	char* shell = getenv( "SHELL" );
+	command_args[0] = ( shell != NULL && strlen( shell ) ) ? shell : "/bin/sh";
+	command_args[1] = "-c";
+	command_args[2] = command;
+	command_args[3] = NULL;
+
+	return command_args;
+}
+
+/**
+ * Replace each occurrence of "{}" in a string by the given item, returning a newly-allocated string.
+ *
+ * NULL is returned if the string does not contain any placeholder. The program is aborted if an error occurs.
+ */
+char* substitute_item( const char* template, const char* item ) {
+	size_t count = 0;
+	for ( const char* pos = strstr( template, "{}" ); pos != NULL; pos = strstr( pos + 2, "{}" ) ) count++;
+	if ( count == 0 ) return NULL;
+
+	const size_t item_len = strlen( item );
+	char* ret = malloc( strlen( template ) + count * item_len - count * 2 + 1 );
+	if ( ret == NULL ) {
+		perror( "malloc" );
+		exit( EXIT_FAILURE );
+	}
+
+	char* out = ret;
+	for ( const char* pos = template; *pos != '\0'; ) {
+		if ( pos[0] == '{' && pos[1] == '}' ) {
+			memcpy( out, item, item_len );
+			out += item_len;
+			pos += 2;
+		} else {
+			*( out++ ) = *( pos++ );
+		}
+	}
+	*out = '\0';
+
+	return ret;
+}
+
+/**
+ * Build the arguments of a command for one item of --each.
+ *
+ * The placeholder "{}" is replaced by the item in every argument; if there is none, the item is appended as a new
+ * argument. The program is aborted if an error occurs.
+ */
+char** substitute_args( char* const* args, char* item ) {
+	size_t argn = 0;
+	int found = 0;
+	while ( args[argn] != NULL ) {
+		if ( strstr( args[argn], "{}" ) != NULL ) found = 1;
+		argn++;
+	}
+
+	char** ret = malloc( sizeof( char* ) * ( argn + 2 ) );
+	if ( ret == NULL ) {
+		perror( "malloc" );
+		exit( EXIT_FAILURE );
+	}
+
+	for ( size_t argi = 0; argi < argn; argi++ ) {
+		char* sub = substitute_item( args[argi], item );
+		ret[argi] = ( sub != NULL ) ? sub : args[argi];
+	}
+	if ( !found ) ret[argn++] = item;
+	ret[argn] = NULL;
+
+	return ret;
+}
+
+/**
+ * Append a new pane without any job to the list, and return it.
+ *
+ * The returned pointer is only valid until the next pane is added. The program is aborted if an error occurs.
+ */
+struct pane* add_pane( struct pane** panes, int* n_panes, char* name, const struct timespec* interval ) {
+	struct pane* new = realloc( ( void* )( *panes ), sizeof( struct pane ) * ( ( *n_panes ) + 1 ) );
+	if ( new == NULL ) {
+		perror( "realloc" );
+		exit( EXIT_FAILURE );
+	}
+
+	struct pane* pane = new + ( *n_panes );
+	memset( pane, 0, sizeof( struct pane ) );
+
+	pane->name = name;
+	pane->interval = *interval;
+	pane->refresh = 2;
+	pane->display_err = -1;
+	pane->snap = new_snapshot();
+	pane->n_views = 1;
+	pane->previous_fd = -1;
+	init_run_env( &pane->env );
+
+	( *panes ) = new;
+	( *n_panes )++;
+
+	return pane;
+}
+
+/**
+ * Append a new job to a pane.
+ *
+ * The program is aborted if an error occurs.
+ */
+void add_job( struct pane* pane, char* label, char** command_args ) {
+	struct job* new = realloc( ( void* )( pane->jobs ), sizeof( struct job ) * ( pane->n_jobs + 1 ) );
+	if ( new == NULL ) {
+		perror( "realloc" );
+		exit( EXIT_FAILURE );
+	}
+
+	struct job* job = new + pane->n_jobs;
+	memset( job, 0, sizeof( struct job ) );
+
+	job->label = label;
+	job->command_args = command_args;
+	job->cmd_pid = -1;
+	job->cmd_fd = -1;
+	job->output_memfd = -1;
+	job->output_len = (size_t) -1;
+
+	pane->jobs = new;
+	pane->n_jobs++;
+}
+
+/**
+ * Read the panes from a configuration file.
+ *
+ * Each non-empty line that does not start with '#' is a command executed through the shell. The line may start with
+ * a number of seconds followed by whitespace, which is then the refresh interval of that pane instead of the default.
+ *
+ * If any error occurs, the program is aborted.
+ */
+void read_pane_file( char* path, struct pane** panes, int* n_panes, const struct timespec* interval ) {
+	FILE* file = fopen( path, "r" );
+	if ( file == NULL ) {
+		fprintf( stderr, "follow: %s: %s\n", path, strerror( errno ) );
+		exit( 2 );
+	}
+
+	char* line = NULL;
+	size_t line_alloc = 0;
+	ssize_t line_len;
+	while ( ( line_len = getline( &line, &line_alloc, file ) ) >= 0 ) {
+		while ( line_len > 0 && ( line[line_len - 1] == '\n' || line[line_len - 1] == '\r' ) ) line[--line_len] = '\0';
+
+		char* start = line;
+		while ( *start == ' ' || *start == '\t' ) start++;
+		if ( *start == '\0' || *start == '#' ) continue;
+
+		struct timespec pane_interval = *interval;
+		char* endptr = NULL;
+		double seconds = strtod( start, &endptr );
+		if ( endptr != start && ( *endptr == ' ' || *endptr == '\t' ) ) {
+			if ( seconds <= 0 ) {
+				fprintf( stderr, "follow: %s: interval not positive in '%s'\n", path, start );
+				exit( 2 );
+			}
+			pane_interval.tv_sec = (time_t) seconds;
+			pane_interval.tv_nsec = (long) ( ( seconds - pane_interval.tv_sec ) * 1000000000 );
+
+			start = endptr;
+			while ( *start == ' ' || *start == '\t' ) start++;
+			if ( *start == '\0' ) continue;
+		}
+
+		char* command = strdup( start );
+		if ( command == NULL ) {
+			perror( "strdup" );
+			exit( EXIT_FAILURE );
+		}
+
+		struct pane* pane = add_pane( panes, n_panes, command, &pane_interval );
+		add_job( pane, command, shell_command_args( command ) );
+	}
+
+	free( line );
+	fclose( file );
+}
+
+/**
+ * Start a new execution of the pane's commands.
+ *
+ * This only marks the jobs as pending; they are actually started by start_job() when there is a free slot.
+ */
+void start_pane( struct pane* pane ) {
+	if ( pane->refresh == 2 ) {
+		safe_monotonic_clock( &pane->next_timer );
+	}
+	add_timespec( &pane->next_timer, pane->samples.interval.tv_sec > 0 || pane->samples.interval.tv_nsec > 0 ? &pane->samples.interval : &pane->interval );
+	pane->refresh = 0;
+
+	for ( int j = 0; j < pane->n_jobs; j++ ) {
+		pane->jobs[j].pending = 1;
+	}
+	pane->running = pane->n_jobs;
+	pane->iterations++;
+
+	/* Tell the commands about the previous execution, so that they can e.g. only process what happened since */
+	update_run_env( &pane->env, pane->iterations, &pane->start_time, pane->last_exit, pane->last_hash );
+
+	clock_gettime( CLOCK_REALTIME, &pane->start_time );
+}
+
+/**
+ * Append a string to the pane's output buffer, growing it as needed.
+ */
+void append_output( struct pane* pane, size_t* len, const char* str, size_t str_len ) {
+	if ( ( *len ) + str_len + 1 > pane->output_alloc ) {
+		size_t new_alloc = MAX( ( *len ) + str_len + 1, 2 * pane->output_alloc );
+		char* new = resize_block( MEMORY_CAPTURE, ( void* ) pane->output_buf, pane->output_alloc, new_alloc );
+		if ( new == NULL ) return;
+		pane->output_buf = new;
+		pane->output_alloc = new_alloc;
+	}
+
+	memcpy( pane->output_buf + ( *len ), str, str_len );
+	( *len ) += str_len;
+	pane->output_buf[*len] = '\0';
+}
+
+/**
+ * Get a snapshot in which the pane's next result can be stored.
+ *
+ * The current one is reused unless something else holds a reference to it.
+ */
+struct snapshot* writable_snapshot( struct pane* pane ) {
+	if ( pane->snap->refs > 1 ) {
+		release_snapshot( pane->snap );
+		pane->snap = new_snapshot();
+	}
+
+	pane->snap->generation = ++snapshot_generation;
+	pane->snap->hashed = 0;
+
+	return pane->snap;
+}
+
+/**
+ * Pin the pane's current result as the baseline to compare the next ones with, or unpin it if there is one already.
+ */
+void toggle_baseline( struct pane* pane ) {
+	if ( pane->baseline != NULL ) {
+		release_snapshot( pane->baseline );
+		pane->baseline = NULL;
+	} else if ( pane->display_err == 0 ) {
+		pane->baseline = pane->snap;
+		pane->baseline->refs++;
+	}
+}
+
+/**
+ * Make a result, whose conversion is complete, the displayed one.
+ */
+void show_result( struct pane* pane, const char* buf, size_t len, int err ) {
+	pane->display_err = err;
+	pane->output_len = len;
+
+	if ( pane->shm != NULL ) {
+		publish_shm( pane->shm, buf, len, &pane->start_time, pane->exit_status, pane->display_err );
+	}
+
+	/* The title describes the result that is now displayed */
+	if ( pane->title.n_segments > 0 ) {
+		long int runtime = 0;
+		for ( int j = 0; j < pane->n_jobs; j++ ) runtime = MAX( runtime, pane->jobs[j].runtime );
+
+		render_title( &pane->title, &pane->start_time, runtime, pane->exit_status, pane->output_len, pane->display_err == 0 ? pane->snap->res_max_height : 0, &pane->interval );
+	}
+
+	/* With --baseline, the first result that is not an error */
+	if ( pane->pin_baseline && pane->display_err == 0 ) {
+		if ( pane->baseline == NULL ) toggle_baseline( pane );
+		pane->pin_baseline = 0;
+	}
+}
+
+/**
+ * Convert one more slice of the pane's pending result, showing it once the conversion is complete.
+ *
+ * The previous result stays on display in the meantime.
+ */
+void continue_pane_conversion( struct pane* pane ) {
+	if ( !continue_conversion( &pane->conv, DECODE_SLICE ) ) return;
+
+	release_snapshot( pane->snap );
+	pane->snap = pane->conv.snap;
+	pane->snap->generation = ++snapshot_generation;
+	pane->converting = 0;
+
+	show_result( pane, pane->conv.buf, pane->conv.len, 0 );
+}
+
+/**
+ * Make the outputs of the jobs of the pane the displayed result, once they have all completed.
+ *
+ * When oversampling, the output is only added to the statistics until the next repaint is due.
+ */
+void finish_pane( struct pane* pane ) {
+	const char* buf;
+	size_t len;
+	int err;
+
+	if ( pane->n_jobs == 1 ) {
+		struct job* job = &pane->jobs[0];
+
+		err = job->output_err;
+		pane->exit_status = job->exit_status;
+		buf = job->output_buf;
+		len = err == 0 ? job->output_len : 0;
+	} else {
+		/* Concatenate the outputs, each preceded by a header line in the style of head(1) and tail(1) */
+		len = 0;
+		pane->exit_status = 0;
+		for ( int j = 0; j < pane->n_jobs; j++ ) {
+			struct job* job = &pane->jobs[j];
+
+			/* The first failure gives the status of the whole */
+			if ( pane->exit_status == 0 ) pane->exit_status = job->exit_status;
+
+			char header[512];
+			int res = snprintf( header, sizeof( header ), "%s==> %s <== (%ld.%03ld s)\n", j > 0 ? "\n" : "", job->label, job->runtime / 1000, job->runtime % 1000 );
+			if ( res > 0 ) append_output( pane, &len, header, MIN( res, sizeof( header ) - 1 ) );
+
+			if ( job->output_err != 0 ) {
+				const char* msg = strerror( job->output_err );
+				append_output( pane, &len, msg, strlen( msg ) );
+				append_output( pane, &len, "\n", 1 );
+			} else {
+				append_output( pane, &len, job->output_buf, job->output_len );
+				if ( job->output_len > 0 && job->output_buf[job->output_len - 1] != '\n' ) append_output( pane, &len, "\n", 1 );
+			}
+		}
+
+		err = 0;
+		buf = pane->output_buf;
+		if ( len < pane->output_alloc / 4 ) trim_block( pane->output_buf, pane->output_alloc, len + 1 );
+	}
+
+	/* The environment of the next execution describes this one, from the raw outputs of the commands */
+	pane->last_exit = pane->exit_status;
+	pane->last_hash = UINT64_C( 14695981039346656037 );
+	for ( int j = 0; j < pane->n_jobs; j++ ) {
+		const struct job* job = &pane->jobs[j];
+		if ( job->output_err == 0 ) pane->last_hash = hash_more( pane->last_hash, job->output_buf, job->output_len );
+	}
+
+	if ( pane->samples.interval.tv_sec > 0 || pane->samples.interval.tv_nsec > 0 ) {
+		if ( err == 0 ) add_sample( &pane->samples, buf, len );
+
+		struct timespec now;
+		safe_monotonic_clock( &now );
+		if ( diff_timespec( &pane->samples.next_display, &now, 3 ) > 0 ) return;
+		pane->samples.next_display = now;
+		add_timespec( &pane->samples.next_display, &pane->interval );
+
+		if ( err == 0 ) {
+			len = render_samples( &pane->samples, buf, len );
+			if ( len == ( size_t ) -1 ) {
+				err = ENOMEM;
+				len = 0;
+			}
+			buf = pane->samples.text;
+		} else {
+			pane->samples.n_fields = 0;
+			pane->samples.n_samples = 0;
+		}
+	}
+
+	if ( err == 0 && pane->decode_budget > 0 ) {
+		/* The output is converted into a new snapshot by the main loop, and the commands are not run again until then */
+		begin_conversion( &pane->conv, buf, len, new_snapshot() );
+		pane->converting = 1;
+		return;
+	}
+
+	if ( err == 0 ) convert_output( buf, len, writable_snapshot( pane ) );
+	show_result( pane, buf, len, err );
+}
+
+/**
+ * Record the end of one of the pane's jobs, finishing the pane if it was the last one.
+ */
+void end_job( struct pane* pane, struct job* job ) {
+	struct timespec end_timer;
+	safe_monotonic_clock( &end_timer );
+	job->runtime = diff_timespec( &end_timer, &job->start_timer, 3 );
+
+	pane->running--;
+	if ( pane->running == 0 ) {
+		finish_pane( pane );
+	}
+}
+
+/* Buffer of the sealed outputs that are empty, which have nothing to map; it is never written to */
+static char empty_output[1];
+
+/**
+ * Make the memory file holding a completed output immutable, so that it can be handed to the next execution.
+ *
+ * The file is truncated to the length of the output and sealed; the buffer becomes a read-only mapping of it, or
+ * empty_output if the output is empty, so that it is never a null pointer.
+ */
+void seal_output( struct job* job ) {
+	const size_t len = job->output_err == 0 ? job->output_len : 0;
+
+	if ( job->output_buf != NULL ) {
+		munmap( (void*) job->output_buf, job->output_alloc + 1 );
+		account_memory( MEMORY_CAPTURE, job->output_alloc + 1, 0 );
+	}
+	job->output_buf = empty_output;
+	job->output_alloc = 0;
+
+	if ( ftruncate( job->output_memfd, len ) == 0 ) {
+		fcntl( job->output_memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL );
+	}
+
+	if ( len > 0 ) {
+		void* buf = mmap( NULL, len, PROT_READ, MAP_SHARED, job->output_memfd, 0 );
+		if ( buf == MAP_FAILED ) {
+			job->output_err = errno;
+		} else {
+			job->output_buf = (char*) buf;
+			job->output_alloc = len;
+			account_memory( MEMORY_CAPTURE, 0, len );
+		}
+	}
+}
+
+/**
+ * Start the execution of a pending job.
+ */
+void start_job( struct pane* pane, struct job* job ) {
+	job->pending = 0;
+	job->exit_status = 0;
+	job->output_err = 0;
+	job->output_len = 0;
+
+	/* With --previous-fd, the output of the previous execution is handed over as it is, and the new one goes to a new memory file */
+	int prev_memfd = -1;
+	int prev_fd = -1;
+	if ( pane->previous_fd >= 0 ) {
+		prev_memfd = job->output_memfd;
+		if ( prev_memfd < 0 ) {
+			free_block( MEMORY_CAPTURE, job->output_buf, job->output_alloc + 1 );
+		} else {
+			/* Only a non-empty output is mapped, see seal_output() */
+			if ( job->output_alloc > 0 ) {
+				munmap( (void*) job->output_buf, job->output_alloc );
+				account_memory( MEMORY_CAPTURE, job->output_alloc, 0 );
+			}
+
+			/* A read-only file descriptor, in addition to the seals */
+			char path[64];
+			snprintf( path, sizeof( path ), "/proc/self/fd/%d", prev_memfd );
+			prev_fd = open( path, O_RDONLY | O_CLOEXEC );
+			if ( prev_fd < 0 ) prev_fd = prev_memfd;
+		}
+
+		job->output_buf = NULL;
+		job->output_alloc = 0;
+		job->output_memfd = memfd_create( "follow-output", MFD_CLOEXEC | MFD_ALLOW_SEALING );
+	}
+
+	safe_monotonic_clock( &job->start_timer );
+	job->cmd_pid = run_command( job->command_args, pane->env.envp, prev_fd, pane->previous_fd, pane->placement, &job->cmd_fd );
+	PROBE2( spawn, job->cmd_pid, job->label );
+
+	/* The command has its own copy of the previous output's file descriptor */
+	if ( prev_fd >= 0 && prev_fd != prev_memfd ) close( prev_fd );
+	if ( prev_memfd >= 0 ) close( prev_memfd );
+
+	if ( job->cmd_pid < 0 ) {
+		job->output_err = errno;
+		end_job( pane, job );
+	}
+}
+
+/**
+ * Read the available output of a job's command.
+ */
+void read_job( struct pane* pane, struct job* job ) {
+	int finished = get_command_output( &job->cmd_pid, &job->cmd_fd, &job->exit_status, job->output_memfd, &job->output_err, &job->output_len, &job->output_alloc, &job->output_buf );
+
+	if ( finished != 0 ) {
+		if ( job->output_memfd >= 0 ) {
+			seal_output( job );
+		}
+
+		end_job( pane, job );
+	}
+}
+
+/**
+ * Compute the heights of the viewports of a pane, given the height available for its output.
+ *
+ * When the pane is split, one row separates the two viewports.
+ */
+void layout_views( struct pane* pane, int display_height, int* view_heights ) {
+	if ( pane->n_views < 2 ) {
+		view_heights[0] = display_height;
+		view_heights[1] = 0;
+	} else {
+		view_heights[0] = MAX( MIN( pane->split_height, display_height - 2 ), MIN( display_height, 1 ) );
+		view_heights[1] = MAX( display_height - view_heights[0] - 1, 0 );
+	}
+}
+
+/* Bounds on the search for the lines that differ from the baseline, in edits and in steps; beyond them, all the lines
+ * between the beginning and the end that are common to both are considered changed */
+#define DIFF_MAX_EDITS 1024
+#define DIFF_MAX_COST ( 1L << 24 )
+
+/**
+ * Grow a buffer of the comparison with the baseline to at least the given size.
+ *
+ * Returns the buffer, possibly moved, or NULL if it could not be grown, in which case it is left as it was.
+ */
+void* grow_diff( void* buf, size_t* alloc, size_t size ) {
+	if ( size <= *alloc ) return buf;
+
+	void* new = tracked_realloc( MEMORY_CACHES, buf, size );
+	if ( new != NULL ) *alloc = size;
+	return new;
+}
+
+/**
+ * Find a shortest edit script from the lines a to the lines b, given by their hashes, with the algorithm of Myers: the
+ * lines of a that are not kept are set in removed, and those of b that are inserted are set in added.
+ *
+ * The search takes a time proportional to the number of lines times the number of edits; it gives up, returning -1,
+ * after DIFF_MAX_EDITS edits or DIFF_MAX_COST steps.
+ */
+int diff_lines( struct pane* pane, const uint64_t* a, int n, const uint64_t* b, int m, char* removed, char* added ) {
+	long int cost = 0;
+
+	for ( int d = 0; d <= DIFF_MAX_EDITS; d++ ) {
+		/* The furthest points after d edits, for the diagonals k = x - y from -d to d, follow those after d - 1 */
+		const size_t need = sizeof( int ) * (size_t) ( d + 1 ) * ( d + 1 );
+		if ( need > pane->diff_trace_alloc ) {
+			const size_t max = sizeof( int ) * (size_t) ( DIFF_MAX_EDITS + 1 ) * ( DIFF_MAX_EDITS + 1 );
+			int* new = grow_diff( pane->diff_trace, &pane->diff_trace_alloc, MIN( MAX( need, 2 * pane->diff_trace_alloc ), max ) );
+			if ( new == NULL ) return -1;
+			pane->diff_trace = new;
+		}
+		int* v = pane->diff_trace + (size_t) d * d + d;
+		const int* prev = v - 2 * d;
+
+		for ( int k = -d; k <= d; k += 2 ) {
+			int x;
+			if ( d == 0 ) {
+				x = 0;
+			} else if ( k == -d || ( k != d && prev[k - 1] < prev[k + 1] ) ) {
+				x = prev[k + 1];
+			} else {
+				x = prev[k - 1] + 1;
+			}
+			int y = x - k;
+			const int x_start = x;
+			while ( x < n && y < m && a[x] == b[y] ) {
+				x++;
+				y++;
+			}
+			v[k] = x;
+			cost += 1 + x - x_start;
+
+			if ( x >= n && y >= m ) {
+				/* Walk the edits back from the end */
+				for ( ; d > 0; d-- ) {
+					v = pane->diff_trace + (size_t) d * d + d;
+					prev = v - 2 * d;
+					k = x - y;
+					if ( k == -d || ( k != d && prev[k - 1] < prev[k + 1] ) ) {
+						x = prev[k + 1];
+						y = x - k - 1;
+						added[y] = 1;
+					} else {
+						x = prev[k - 1];
+						y = x - k + 1;
+						removed[x] = 1;
+					}
+				}
+				return 0;
+			}
+		}
+
+		if ( cost > DIFF_MAX_COST ) return -1;
+	}
+
+	return -1;
+}
+
+/**
+ * Find which lines differ between the pane's result and its baseline, unless already done for these two, and lay out
+ * the rows of the inline comparison.
+ *
+ * Lines are compared in order, by their hashes, so that a line that moved is both removed and added. The lines that the
+ * result and the baseline have in common at their beginning and at their end are skipped at once, so that the search
+ * only takes long when many lines changed, up to the bounds of diff_lines(). Within a change, the removed lines come
+ * before the added ones.
+ */
+void update_diff( struct pane* pane ) {
+	struct snapshot* snap = pane->snap;
+	struct snapshot* base = pane->baseline;
+
+	if ( snap->generation == pane->diff_generation && base->generation == pane->diff_base_generation ) return;
+
+	const int n = base->res_max_height;
+	const int m = snap->res_max_height;
+
+	char* diff_snap = grow_diff( pane->diff_snap, &pane->diff_alloc, MAX( m, 1 ) );
+	if ( diff_snap == NULL ) return;
+	pane->diff_snap = diff_snap;
+	char* diff_base = grow_diff( pane->diff_base, &pane->diff_base_alloc, MAX( n, 1 ) );
+	if ( diff_base == NULL ) return;
+	pane->diff_base = diff_base;
+	int* rows = grow_diff( pane->diff_rows, &pane->diff_rows_alloc, sizeof( int ) * MAX( n + m, 1 ) );
+	if ( rows == NULL ) return;
+	pane->diff_rows = rows;
+
+	memset( diff_snap, 0, m );
+	memset( diff_base, 0, n );
+
+	if ( snap != base ) {
+		hash_lines( snap );
+		hash_lines( base );
+		if ( !snap->hashed || !base->hashed ) return;
+
+		const uint64_t* a = base->lines_hash;
+		const uint64_t* b = snap->lines_hash;
+		int start = 0;
+		while ( start < n && start < m && a[start] == b[start] ) start++;
+		int end_a = n;
+		int end_b = m;
+		while ( end_a > start && end_b > start && a[end_a - 1] == b[end_b - 1] ) {
+			end_a--;
+			end_b--;
+		}
+
+		if ( diff_lines( pane, a + start, end_a - start, b + start, end_b - start, diff_base + start, diff_snap + start ) != 0 ) {
+			memset( diff_base + start, 1, end_a - start );
+			memset( diff_snap + start, 1, end_b - start );
+		}
+	}
+
+	/* The lines kept, in the same order in both, are interleaved with the removed and the added ones */
+	pane->diff_added = 0;
+	pane->diff_removed = 0;
+	pane->diff_n_rows = 0;
+	for ( int i = 0, j = 0; i < n || j < m; ) {
+		if ( i < n && diff_base[i] ) {
+			rows[pane->diff_n_rows++] = -1 - i++;
+			pane->diff_removed++;
+		} else if ( j < m && diff_snap[j] ) {
+			rows[pane->diff_n_rows++] = j++;
+			pane->diff_added++;
+		} else {
+			rows[pane->diff_n_rows++] = j++;
+			i++;
+		}
+	}
+
+	pane->diff_generation = snap->generation;
+	pane->diff_base_generation = base->generation;
+}
+
+/**
+ * Whether the pane shows the inline comparison of its result with the baseline.
+ */
+int shows_diff( const struct pane* pane ) {
+	return pane->display_err == 0 && pane->baseline != NULL && !pane->side_by_side && pane->diff_generation == pane->snap->generation && pane->diff_base_generation == pane->baseline->generation;
+}
+
+/**
+ * Number of rows of the pane's result as shown, which includes the removed lines in the inline comparison.
+ */
+int pane_rows( const struct pane* pane ) {
+	return shows_diff( pane ) ? pane->diff_n_rows : pane->snap->res_max_height;
+}
+
+/**
+ * Width of the widest line of the pane's result as shown, including the removed lines in the inline comparison.
+ */
+int pane_width( const struct pane* pane ) {
+	return shows_diff( pane ) ? MAX( pane->snap->res_max_width, pane->baseline->res_max_width ) : pane->snap->res_max_width;
+}
+
+/**
+ * Row at which a line of the pane's result is shown.
+ */
+int line_row( const struct pane* pane, int line ) {
+	if ( !shows_diff( pane ) ) return line;
+
+	int row = 0;
+	while ( row < pane->diff_n_rows && pane->diff_rows[row] < line ) row++;
+	return row;
+}
+
+/**
+ * Line of the pane's result shown at a row, or the next one for a removed line.
+ */
+int row_line( const struct pane* pane, int row ) {
+	if ( !shows_diff( pane ) ) return row;
+
+	while ( row < pane->diff_n_rows && pane->diff_rows[row] < 0 ) row++;
+	return row < pane->diff_n_rows ? pane->diff_rows[row] : pane->snap->res_max_height - 1;
+}
+
+/**
+ * Key under which a line is stored in the table of the marks, given the hash of the line before it.
+ *
+ * The first line has no context, so that its key is its hash alone.
+ */
+uint64_t mark_key( uint64_t hash, uint64_t context ) {
+	if ( context == 0 ) return hash;
+
+	uint64_t key = hash ^ ( context * UINT64_C( 0x9e3779b97f4a7c15 ) );
+	return key == 0 ? 1 : key;
+}
+
+/**
+ * Set a mark on the given line of the pane's result.
+ */
+void set_mark( struct pane* pane, int m, int line ) {
+	struct snapshot* snap = pane->snap;
+	if ( pane->display_err != 0 || line < 0 || line >= snap->res_max_height ) return;
+
+	hash_lines( snap );
+	if ( !snap->hashed ) return;
+
+	pane->marks[m].hash = snap->lines_hash[line];
+	pane->marks[m].context = line > 0 ? snap->lines_hash[line - 1] : 0;
+	pane->marks[m].line = line;
+	pane->marks[m].lost = 0;
+	pane->marks_generation = snap->generation;
+}
+
+/**
+ * Find the marked lines in the pane's result, unless already done for this one.
+ *
+ * A mark stays on its line if that line still has the same content and follows the same line. Otherwise, it moves to
+ * the first line with the same content, preferably after the same line, which is looked up in a table of the lines of
+ * the result; the table is only built when a mark moved. A mark whose line is not found is flagged as lost, but keeps
+ * its last position and content so that it is found again if the line comes back.
+ */
+void update_marks( struct pane* pane ) {
+	struct snapshot* snap = pane->snap;
+	if ( pane->display_err != 0 || pane->marks_generation == snap->generation ) return;
+
+	int table_ready = 0;
+	for ( int m = 0; m < N_MARKS; m++ ) {
+		struct mark* mark = &pane->marks[m];
+		if ( mark->hash == 0 ) continue;
+
+		hash_lines( snap );
+		if ( !snap->hashed ) return;
+
+		if ( mark->line < snap->res_max_height && snap->lines_hash[mark->line] == mark->hash && ( mark->line > 0 ? snap->lines_hash[mark->line - 1] : 0 ) == mark->context ) {
+			mark->lost = 0;
+			continue;
+		}
+
+		if ( !table_ready ) {
+			if ( clear_line_table( &pane->marks_table, 2 * snap->res_max_height ) < 0 ) return;
+
+			/* Backwards, so that the first occurrence of a line is the one that remains */
+			for ( int i = snap->res_max_height - 1; i >= 0; i-- ) {
+				const uint64_t context = i > 0 ? snap->lines_hash[i - 1] : 0;
+				( *line_table_get( &pane->marks_table, snap->lines_hash[i], 1 ) ) = i + 1;
+				( *line_table_get( &pane->marks_table, mark_key( snap->lines_hash[i], context ), 1 ) ) = i + 1;
+			}
+			table_ready = 1;
+		}
+
+		int* found = line_table_get( &pane->marks_table, mark_key( mark->hash, mark->context ), 0 );
+		if ( found == NULL ) found = line_table_get( &pane->marks_table, mark->hash, 0 );
+
+		if ( found != NULL ) {
+			mark->line = ( *found ) - 1;
+			mark->context = mark->line > 0 ? snap->lines_hash[mark->line - 1] : 0;
+			mark->lost = 0;
+		} else {
+			mark->lost = 1;
+		}
+	}
+
+	pane->marks_generation = snap->generation;
+}
+
+/**
+ * Show the summary of the comparison with the baseline and the marks that were lost in the pane's title line, just
+ * before its right part.
+ */
+void show_pane_status( struct screen* screen, int row, int screen_width, struct pane* pane ) {
+	char buf[64 + 3 * N_MARKS];
+	int res = 0;
+
+	if ( pane->baseline != NULL ) {
+		res = snprintf( buf, sizeof( buf ), " [baseline +%d -%d]", pane->diff_added, pane->diff_removed );
+		if ( res < 0 ) return;
+	}
+
+	int n_lost = 0;
+	for ( int m = 0; m < N_MARKS; m++ ) {
+		if ( pane->marks[m].hash == 0 || !pane->marks[m].lost ) continue;
+		res += snprintf( buf + res, sizeof( buf ) - res, n_lost == 0 ? " [lost '%c" : " '%c", 'a' + m );
+		n_lost++;
+	}
+	if ( n_lost > 0 ) res += snprintf( buf + res, sizeof( buf ) - res, "]" );
+
+	if ( res == 0 ) return;
+	res += snprintf( buf + res, sizeof( buf ) - res, " " );
+
+	const int right_len = pane->title.len[1];
+	const int start = screen_width - right_len - res;
+	if ( start < 0 ) return;
+
+	put_screen_str( screen, row, start, buf, res, A_REVERSE | A_BOLD );
+}
+
+/**
+ * Width of the line-number gutter for a snapshot, including the space that separates it from the text.
+ */
+int gutter_width( const struct snapshot* snap ) {
+	int digits = 1;
+	for ( int n = snap->res_max_height; n >= 10; n /= 10 ) digits++;
+	return digits + 1;
+}
+
+/**
+ * Show the part of a result that falls within the viewport, in the given area of the window.
+ *
+ * Lines for which changed is set (if not NULL) are highlighted.
+ */
+void show_output( struct screen* screen, struct snapshot* snap, struct viewport* view, const char* changed, int numbers, int top, int left, int display_height, int display_width ) {
+	/* The gutter is only shown if there is still room for some text */
+	const int gutter = numbers ? gutter_width( snap ) : 0;
+	if ( gutter > 0 && gutter < display_width ) {
+		left += gutter;
+		display_width -= gutter;
+	} else {
+		numbers = 0;
+	}
+
+	const int v_offset = view->v_offset;
+	const int h_offset = view->h_offset;
+	const int res_max_height = snap->res_max_height;
+
+	/* Rows entirely out of the horizontal range still get their line number */
+	if ( v_offset > -display_height && v_offset < res_max_height ) {
+		int v_disp_off = MAX( -v_offset, 0 );
+		int v_start = MAX( v_offset, 0 );
+		int h_disp_off = MAX( -h_offset, 0 );
+		int h_start = MAX( h_offset, 0 );
+
+		const int v_end = MIN( v_offset + display_height, res_max_height ) - v_start;
+		for ( int v = 0; v < v_end; v++ ) {
+			if ( numbers ) {
+				char number[32];
+				const int res = snprintf( number, sizeof( number ), "%*d", gutter - 1, v + v_start + 1 );
+				put_screen_str( screen, top + v_disp_off + v, left - gutter, number, res, 0 );
+			}
+
+			const int line_len = snap->lines_len[v + v_start];
+			if ( line_len <= h_offset ) {
+				continue;
+			}
+			const int h_end = MIN( line_len, h_offset + display_width ) - h_start;
+
+			if ( h_end > 0 ) {
+				const int highlight = ( changed != NULL && changed[v + v_start] );
+				put_screen( screen, top + v_disp_off + v, left + h_disp_off, snap->lines[v + v_start] + h_start, h_end, highlight ? A_BOLD : 0 );
+			}
+		}
+	}
+}
+
+/**
+ * Show the part of the inline comparison of the pane's result with its baseline that falls within the viewport.
+ *
+ * A column after the line numbers marks the added lines with a + and the lines of the baseline removed from the result,
+ * which have no line number, with a -.
+ */
+void show_diff( struct screen* screen, struct pane* pane, struct viewport* view, int numbers, int top, int display_height, int display_width ) {
+	/* The line numbers are only shown if there is still room for some text */
+	int gutter = numbers ? gutter_width( pane->snap ) + 1 : 1;
+	if ( gutter >= display_width ) {
+		numbers = 0;
+		gutter = 1;
+	}
+	if ( gutter >= display_width ) return;
+	const int left = gutter;
+	display_width -= gutter;
+
+	const int v_offset = view->v_offset;
+	const int h_offset = view->h_offset;
+	const int n_rows = pane->diff_n_rows;
+
+	if ( v_offset > -display_height && v_offset < n_rows ) {
+		int v_disp_off = MAX( -v_offset, 0 );
+		int v_start = MAX( v_offset, 0 );
+		int h_disp_off = MAX( -h_offset, 0 );
+		int h_start = MAX( h_offset, 0 );
+
+		const int v_end = MIN( v_offset + display_height, n_rows ) - v_start;
+		for ( int v = 0; v < v_end; v++ ) {
+			const int row = top + v_disp_off + v;
+			const int line = pane->diff_rows[v + v_start];
+			const struct snapshot* snap = line >= 0 ? pane->snap : pane->baseline;
+			const int n = line >= 0 ? line : -1 - line;
+			attr_t attrs = A_NORMAL;
+			char marker = ' ';
+			if ( line < 0 ) {
+				attrs = A_DIM;
+				marker = '-';
+			} else if ( pane->diff_snap[line] ) {
+				attrs = A_BOLD;
+				marker = '+';
+			}
+
+			if ( numbers && line >= 0 ) {
+				char number[32];
+				const int res = snprintf( number, sizeof( number ), "%*d", gutter - 2, line + 1 );
+				put_screen_str( screen, row, 0, number, res, 0 );
+			}
+			put_screen_str( screen, row, gutter - 1, &marker, 1, attrs );
+
+			const int line_len = snap->lines_len[n];
+			if ( line_len <= h_offset ) {
+				continue;
+			}
+			const int h_end = MIN( line_len, h_offset + display_width ) - h_start;
+
+			if ( h_end > 0 ) {
+				put_screen( screen, row, left + h_disp_off, snap->lines[n] + h_start, h_end, attrs );
+			}
+		}
+	}
+}
+
+/**
+ * Show the pane's result within the viewport, along with the comparison with the baseline if there is one.
+ */
+void show_pane_output( struct screen* screen, struct pane* pane, struct viewport* view, int numbers, int top, int display_height, int display_width ) {
+	if ( pane->display_err != 0 ) {
+		/* display_err is negative before the first command finishes; don't display anything during that time */
+		if ( pane->display_err > 0 ) put_screen_str( screen, top, 0, strerror( pane->display_err ), display_width, 0 );
+	} else if ( pane->baseline == NULL || pane->diff_generation != pane->snap->generation || pane->diff_base_generation != pane->baseline->generation ) {
+		/* No baseline, or the comparison could not be made */
+		show_output( screen, pane->snap, view, NULL, numbers, top, 0, display_height, display_width );
+	} else if ( !pane->side_by_side ) {
+		show_diff( screen, pane, view, numbers, top, display_height, display_width );
+	} else {
+		/* Baseline on the left, current result on the right */
+		const int left_width = ( display_width - 1 ) / 2;
+		const int right_width = display_width - left_width - 1;
+
+		show_output( screen, pane->baseline, view, pane->diff_base, numbers, top, 0, display_height, left_width );
+		vline_screen( screen, top, left_width, display_height, 0 );
+		show_output( screen, pane->snap, view, pane->diff_snap, numbers, top, left_width + 1, display_height, right_width );
+	}
+}
+
+/* Maximal number of simultaneous connections to the control socket */
+#define CONTROL_MAX_CLIENTS 8
+
+/* Maximal length of a command received on the control socket */
+#define CONTROL_LINE_MAX 256
+
+/**
+ * Connection to the control socket.
+ */
+struct client {
+	int fd;
+	int closing; /* the peer finished sending commands; close once the replies are sent */
+	size_t in_len;
+	char in_buf[CONTROL_LINE_MAX];
+	size_t out_start;
+	size_t out_len;
+	size_t out_alloc;
+	char* out_buf;
+	struct snapshot* dump; /* snapshot being sent by the "dump" command, along with the next line to send */
+	int dump_line;
+};
+
+/**
+ * Control socket and its connections.
+ */
+struct control {
+	int fd;
+	int n_clients;
+	struct client clients[CONTROL_MAX_CLIENTS];
+};
+
+/**
+ * Open the control socket at the given path and start listening on it.
+ *
+ * A stale socket left at that path is replaced. If any error occurs, the program is aborted.
+ */
+void open_control( struct control* control, char* path ) {
+	struct sockaddr_un addr;
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sun_family = AF_UNIX;
+	if ( strlen( path ) >= sizeof( addr.sun_path ) ) {
+		fprintf( stderr, "follow: control socket path too long '%s'\n", path );
+		exit( 2 );
+	}
+	strncpy( addr.sun_path, path, sizeof( addr.sun_path ) - 1 );
+
+	/* A socket left by a follow that exited can be replaced, but not one on which another follow still listens */
+	struct stat st;
+	if ( lstat( path, &st ) == 0 && S_ISSOCK( st.st_mode ) ) {
+		int probe = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+		if ( probe < 0 ) {
+			perror( "socket" );
+			exit( EXIT_FAILURE );
+		}
+
+		if ( connect( probe, (struct sockaddr*) &addr, sizeof( addr ) ) == 0 ) {
+			fprintf( stderr, "follow: control socket '%s' is in use by another process\n", path );
+			exit( EXIT_FAILURE );
+		}
+		const int connect_errno = errno;
+		close( probe );
+
+		if ( connect_errno == ECONNREFUSED ) unlink( path );
+	}
+
+	control->fd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+	if ( control->fd < 0 ) {
+		perror( "socket" );
+		exit( EXIT_FAILURE );
+	}
+
+	if ( bind( control->fd, (struct sockaddr*) &addr, sizeof( addr ) ) < 0 || listen( control->fd, CONTROL_MAX_CLIENTS ) < 0 ) {
+		fprintf( stderr, "follow: %s: %s\n", path, strerror( errno ) );
+		exit( EXIT_FAILURE );
+	}
+
+	control_path = path;
+	control->n_clients = 0;
+}
+
+/**
+ * Queue data to be sent to a client.
+ */
+void client_write( struct client* client, const char* data, size_t len ) {
+	if ( client->out_len + len > client->out_alloc ) {
+		size_t new_alloc = MAX( client->out_len + len, 2 * client->out_alloc );
+		char* new = tracked_realloc( MEMORY_CONTROL, ( void* ) client->out_buf, new_alloc );
+		if ( new == NULL ) return;
+		client->out_buf = new;
+		client->out_alloc = new_alloc;
+	}
+
+	memcpy( client->out_buf + client->out_len, data, len );
+	client->out_len += len;
+}
+
+/**
+ * Queue a formatted reply to be sent to a client.
+ */
+void client_printf( struct client* client, const char* format, ... ) {
+	char buf[512];
+	va_list ap;
+	va_start( ap, format );
+	int res = vsnprintf( buf, sizeof( buf ), format, ap );
+	va_end( ap );
+
+	if ( res > 0 ) client_write( client, buf, MIN( res, sizeof( buf ) - 1 ) );
+}
+
+/**
+ * Queue the next lines of the snapshot being dumped, encoded back to multibyte characters.
+ *
+ * Lines are encoded in batches, so that a large snapshot does not need to be held twice in memory.
+ */
+void client_dump( struct client* client ) {
+	struct snapshot* snap = client->dump;
+	const size_t batch = 65536;
+	size_t queued = 0;
+
+	while ( client->dump_line < snap->res_max_height && queued < batch ) {
+		const int line_len = snap->lines_len[client->dump_line];
+		const size_t max_len = (size_t) line_len * MB_CUR_MAX + 1;
+
+		if ( client->out_len + max_len > client->out_alloc ) {
+			size_t new_alloc = MAX( client->out_len + max_len, 2 * client->out_alloc );
+			char* new = tracked_realloc( MEMORY_CONTROL, ( void* ) client->out_buf, new_alloc );
+			if ( new == NULL ) break;
+			client->out_buf = new;
+			client->out_alloc = new_alloc;
+		}
+
+		mbstate_t ps;
+		memset( &ps, 0, sizeof( ps ) );
+		const wchar_t* src = snap->lines[client->dump_line];
+		size_t res = wcsnrtombs( client->out_buf + client->out_len, &src, line_len, max_len, &ps );
+		if ( res != ( size_t ) -1 ) {
+			client->out_len += res;
+			queued += res;
+		}
+		client->out_buf[client->out_len++] = '\n';
+		queued++;
+
+		client->dump_line++;
+	}
+
+	if ( client->dump_line >= snap->res_max_height ) {
+		release_snapshot( snap );
+		client->dump = NULL;
+	}
+}
+
+/**
+ * Execute one command received on the control socket.
+ *
+ * Commands apply to the pane given as last argument (counting from 1), or to the focused one if there is none.
+ */
+void control_command( struct client* client, char* line, struct pane* panes, int n_panes, int focus ) {
+	char* argv[3] = { NULL, NULL, NULL };
+	int argc = 0;
+	for ( char* tok = strtok( line, " \t\r" ); tok != NULL && argc < 3; tok = strtok( NULL, " \t\r" ) ) {
+		argv[argc++] = tok;
+	}
+	if ( argc == 0 ) return;
+
+	const int n_args = strcmp( argv[0], "interval" ) == 0 ? 2 : 1;
+	struct pane* pane = &panes[focus];
+	if ( argc > n_args ) {
+		char* endptr = NULL;
+		long int index = strtol( argv[n_args], &endptr, 10 );
+		if ( *endptr != '\0' || index < 1 || index > n_panes ) {
+			client_printf( client, "error: invalid pane '%s'\n", argv[n_args] );
+			return;
+		}
+		pane = &panes[index - 1];
+	}
+
+	if ( strcmp( argv[0], "refresh" ) == 0 ) {
+		pane->refresh = 2;
+		client_printf( client, "ok\n" );
+	} else if ( strcmp( argv[0], "pause" ) == 0 ) {
+		pane->paused = 1;
+		client_printf( client, "ok\n" );
+	} else if ( strcmp( argv[0], "resume" ) == 0 ) {
+		if ( pane->paused ) pane->refresh = 2;
+		pane->paused = 0;
+		client_printf( client, "ok\n" );
+	} else if ( strcmp( argv[0], "interval" ) == 0 ) {
+		char* endptr = NULL;
+		double seconds = argc > 1 ? strtod( argv[1], &endptr ) : 0;
+		if ( argc < 2 || *endptr != '\0' || seconds <= 0 ) {
+			client_printf( client, "error: invalid interval\n" );
+			return;
+		}
+		pane->interval.tv_sec = (time_t) seconds;
+		pane->interval.tv_nsec = (long) ( ( seconds - pane->interval.tv_sec ) * 1000000000 );
+		pane->refresh = 2;
+		client_printf( client, "ok\n" );
+	} else if ( strcmp( argv[0], "dump" ) == 0 ) {
+		if ( client->dump != NULL ) {
+			client_printf( client, "error: dump in progress\n" );
+		} else if ( pane->display_err != 0 ) {
+			client_printf( client, "error: %s\n", pane->display_err > 0 ? strerror( pane->display_err ) : "no output yet" );
+		} else {
+			/* The number of lines comes first, so that the client knows where the dump ends */
+			client_printf( client, "ok %d\n", pane->snap->res_max_height );
+			client->dump = pane->snap;
+			client->dump->refs++;
+			client->dump_line = 0;
+		}
+	} else if ( strcmp( argv[0], "stats" ) == 0 ) {
+		long int runtime = 0;
+		for ( int j = 0; j < pane->n_jobs; j++ ) runtime = MAX( runtime, pane->jobs[j].runtime );
+
+		client_printf( client, "pane %d/%d\n", (int)( pane - panes ) + 1, n_panes );
+		client_printf( client, "command %s\n", pane->name );
+		client_printf( client, "interval %ld.%03ld\n", (long int) pane->interval.tv_sec, pane->interval.tv_nsec / 1000000 );
+		client_printf( client, "paused %d\n", pane->paused );
+		client_printf( client, "running %d\n", pane->running );
+		client_printf( client, "iterations %lu\n", pane->iterations );
+		client_printf( client, "runtime %ld.%03ld\n", runtime / 1000, runtime % 1000 );
+		client_printf( client, "error %d\n", MAX( pane->display_err, 0 ) );
+		client_printf( client, "lines %d\n", pane->snap->res_max_height );
+		client_printf( client, "width %d\n", pane->snap->res_max_width );
+
+		/* These are for the whole program */
+		long int rss, peak;
+		if ( resident_memory( &rss, &peak ) == 0 ) {
+			client_printf( client, "rss_kb %ld\n", rss );
+			client_printf( client, "rss_peak_kb %ld\n", peak );
+		}
+		client_printf( client, "ok\n" );
+	} else if ( strcmp( argv[0], "memory" ) == 0 ) {
+		/* These are for the whole program */
+		for ( int u = 0; u < N_MEMORY_USES; u++ ) {
+			client_printf( client, "%s %zu %zu\n", memory_use_names[u], memory_current[u], memory_peak[u] );
+		}
+		client_printf( client, "ok\n" );
+	} else {
+		client_printf( client, "error: unknown command '%s'\n", argv[0] );
+	}
+}
+
+/**
+ * Close a connection to the control socket.
+ */
+void close_client( struct control* control, int c ) {
+	struct client* client = &control->clients[c];
+
+	close( client->fd );
+	tracked_free( MEMORY_CONTROL, client->out_buf );
+	release_snapshot( client->dump );
+
+	control->n_clients--;
+	control->clients[c] = control->clients[control->n_clients];
+}
+
+/**
+ * Fill the poll entries for the control socket and its connections, returning how many were used.
+ */
+int poll_control( struct control* control, struct pollfd* fd_desc ) {
+	fd_desc[0].fd = control->n_clients < CONTROL_MAX_CLIENTS ? control->fd : -1;
+	fd_desc[0].events = POLLIN;
+	fd_desc[0].revents = 0;
+
+	for ( int c = 0; c < control->n_clients; c++ ) {
+		struct client* client = &control->clients[c];
+		fd_desc[c + 1].fd = client->fd;
+		const int pending = ( client->out_len > client->out_start || client->dump != NULL || memchr( client->in_buf, '\n', client->in_len ) != NULL );
+		fd_desc[c + 1].events = ( client->closing ? 0 : POLLIN ) | ( pending ? POLLOUT : 0 );
+		fd_desc[c + 1].revents = 0;
+	}
+
+	return control->n_clients + 1;
+}
+
+/**
+ * Service the control socket: accept new connections, execute the commands received and send the replies.
+ *
+ * All the sockets are non-blocking, so that this never holds up the rest of the main loop.
+ */
+void service_control( struct control* control, struct pollfd* fd_desc, struct pane* panes, int n_panes, int focus ) {
+	/* Go through the existing connections backwards, as closing one moves the last one in its place */
+	for ( int c = control->n_clients - 1; c >= 0; c-- ) {
+		struct client* client = &control->clients[c];
+		const short revents = fd_desc[c + 1].revents;
+
+		if ( revents & POLLIN ) {
+			ssize_t nread = read( client->fd, client->in_buf + client->in_len, sizeof( client->in_buf ) - client->in_len );
+			if ( nread == 0 ) {
+				client->closing = 1;
+			} else if ( nread < 0 && errno != EAGAIN && errno != EINTR ) {
+				close_client( control, c );
+				continue;
+			} else if ( nread > 0 ) {
+				client->in_len += nread;
+			}
+		} else if ( revents & ( POLLHUP | POLLERR ) && !( revents & POLLOUT ) ) {
+			close_client( control, c );
+			continue;
+		}
+
+		/* Execute the complete lines; a dump must be sent completely before the replies to the following commands */
+		char* line = client->in_buf;
+		char* end;
+		while ( client->dump == NULL && ( end = memchr( line, '\n', client->in_len - ( line - client->in_buf ) ) ) != NULL ) {
+			*end = '\0';
+			control_command( client, line, panes, n_panes, focus );
+			line = end + 1;
+		}
+		client->in_len -= line - client->in_buf;
+		memmove( client->in_buf, line, client->in_len );
+
+		if ( client->in_len == sizeof( client->in_buf ) && memchr( client->in_buf, '\n', client->in_len ) == NULL ) {
+			client_printf( client, "error: command too long\n" );
+			client->in_len = 0;
+		}
+
+		if ( client->dump != NULL && client->out_len == client->out_start ) {
+			client->out_start = 0;
+			client->out_len = 0;
+			client_dump( client );
+		}
+
+		if ( client->out_len > client->out_start ) {
+			ssize_t nwritten = write( client->fd, client->out_buf + client->out_start, client->out_len - client->out_start );
+			if ( nwritten < 0 && errno != EAGAIN && errno != EINTR ) {
+				close_client( control, c );
+				continue;
+			} else if ( nwritten > 0 ) {
+				client->out_start += nwritten;
+			}
+
+			if ( client->out_start == client->out_len ) {
+				client->out_start = 0;
+				client->out_len = 0;
+			}
+		}
+
+		if ( client->closing && client->out_len == 0 && client->dump == NULL && memchr( client->in_buf, '\n', client->in_len ) == NULL ) {
+			close_client( control, c );
+		}
+	}
+
+	if ( fd_desc[0].revents & POLLIN ) {
+		int fd = accept4( control->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+		if ( fd >= 0 ) {
+			struct client* client = &control->clients[control->n_clients++];
+			memset( client, 0, sizeof( struct client ) );
+			client->fd = fd;
+		}
+	}
+}
+
+/* Number of rows moved by one step of the mouse wheel */
+#define WHEEL_ROWS 3
+
+/**
+ * Find the pane and the view at the given row of the screen.
+ *
+ * Returns the index of the pane and sets view; on a title line or a separator, this is the pane's current view.
+ */
+int pane_at( struct pane* panes, int n_panes, int screen_height, int title_height, int row, int* view ) {
+	const int p = MAX( MIN( n_panes - 1, row * n_panes / MAX( screen_height, 1 ) ), 0 );
+	const int pane_top = p * screen_height / n_panes;
+	const int pane_height = ( p + 1 ) * screen_height / n_panes - pane_top;
+
+	int view_heights[2];
+	layout_views( &panes[p], pane_height - title_height, view_heights );
+
+	const int view_row = row - pane_top - title_height;
+	if ( view_row >= 0 && view_row < view_heights[0] ) {
+		( *view ) = 0;
+	} else if ( panes[p].n_views > 1 && view_row > view_heights[0] ) {
+		( *view ) = 1;
+	} else {
+		( *view ) = panes[p].view;
+	}
+
+	return p;
+}
+
+/**
+ * Read a burst of mouse wheel events, starting with the one that was just received, and return the number of rows by
+ * which to move (positive downwards).
+ *
+ * Events are consumed as long as they are wheel steps over the same view, so that a fast scroll results in a single
+ * move and a single frame. The first other key or event is pushed back, in which case pushed_back is set. The view under
+ * the pointer gets the focus.
+ */
+int read_wheel( WINDOW* win, struct pane* panes, int n_panes, int* focus, int screen_height, int title_height, int* pushed_back ) {
+	int rows = 0;
+	int target = -1;
+	int target_view = 0;
+
+	MEVENT event;
+	while ( getmouse( &event ) == OK ) {
+		int step = 0;
+		if ( event.bstate & BUTTON4_PRESSED ) step = -WHEEL_ROWS;
+#ifdef BUTTON5_PRESSED
+		if ( event.bstate & BUTTON5_PRESSED ) step = WHEEL_ROWS;
+#endif
+
+		int view;
+		const int p = pane_at( panes, n_panes, screen_height, title_height, event.y, &view );
+		if ( target >= 0 && ( step == 0 || p != target || view != target_view ) ) {
+			ungetmouse( &event );
+			( *pushed_back ) = 1;
+			break;
+		}
+		if ( step == 0 ) break;
+
+		target = p;
+		target_view = view;
+		rows += step;
+
+		const int key = wgetch( win );
+		if ( key == KEY_MOUSE ) continue;
+		if ( key != ERR ) {
+			ungetch( key );
+			( *pushed_back ) = 1;
+		}
+		break;
+	}
+
+	if ( target >= 0 ) {
+		( *focus ) = target;
+		panes[target].view = target_view;
+	}
+
+	return rows;
+}
+
+/**
+ * Renderer that draws the frames to the terminal itself, without curses.
+ *
+ * The panes are composed in a frame of cells, straight from the lines of their results and from their titles, and only
+ * terminfo is used, for the capabilities of the terminal. The rows of the frame are compared with those of the previous
+ * one by their hash, to find whether the content moved up or down, in which case that part of the terminal is scrolled.
+ * Each row that still differs is then compared cell by cell, and only the span that changed is drawn again. A frame is
+ * sent with a single write(). Keys are read and parsed here as well.
+ */
+struct direct {
+	int out_fd;
+	int in_fd; /* -1 if keys are not read, e.g. in batch mode */
+	int rows;
+	int cols;
+	int full; /* whether the next frame is drawn from scratch */
+	int corner; /* whether the bottom-right cell can be drawn without scrolling */
+
+	/* Previous frame, and the new one that the panes are drawn in */
+	struct frame frames[2];
+	int* row_end[2]; /* start of the blank end of each row */
+	uint64_t* row_hash[2];
+
+	/* Bytes of the frame being sent */
+	size_t out_len;
+	size_t out_alloc;
+	char* out;
+	attr_t attrs; /* attributes in effect on the terminal */
+
+	/* Capabilities */
+	const char* cup;
+	const char* el;
+	const char* clear;
+	const char* sgr0;
+	const char* rev;
+	const char* bold;
+	const char* dim;
+	const char* csr;
+	const char* ind;
+	const char* ri;
+
+	/* Keys received but not handled yet */
+	size_t in_len;
+	char in[64];
+	int escape_delay; /* time to wait for the rest of an escape sequence, in milliseconds */
+	int escape_pending; /* whether the keys start with an unfinished escape sequence, received at escape_start */
+	struct timespec escape_start;
+};
+
+/* Key sequences, from terminfo or as sent by most terminals in either cursor mode */
+static struct {
+	const char* cap;
+	const char* seq;
+	int key;
+} direct_keys[] = {
+	{ "kcuu1", NULL, KEY_UP },
+	{ "kcud1", NULL, KEY_DOWN },
+	{ "kcub1", NULL, KEY_LEFT },
+	{ "kcuf1", NULL, KEY_RIGHT },
+	{ "kcbt", NULL, KEY_BTAB },
+	{ NULL, "\033[A", KEY_UP },
+	{ NULL, "\033[B", KEY_DOWN },
+	{ NULL, "\033[D", KEY_LEFT },
+	{ NULL, "\033[C", KEY_RIGHT },
+	{ NULL, "\033OA", KEY_UP },
+	{ NULL, "\033OB", KEY_DOWN },
+	{ NULL, "\033OD", KEY_LEFT },
+	{ NULL, "\033OC", KEY_RIGHT },
+	{ NULL, "\033[Z", KEY_BTAB },
+	{ NULL, NULL, 0 },
+};
+
+/* Set when the terminal was resized */
+static volatile sig_atomic_t direct_resized = 0;
+
+/**
+ * Handler of SIGWINCH for the direct renderer.
+ */
+void direct_resize_signal( int signal ) {
+	direct_resized = 1;
+}
+
+/**
+ * Get a string capability of the terminal, or NULL if it does not have it.
+ */
+const char* direct_cap( const char* name ) {
+	char* cap = tigetstr( name );
+	return cap == (char*) -1 ? NULL : cap;
+}
+
+/**
+ * Append bytes to the frame being built.
+ */
+void direct_append( struct direct* direct, const char* buf, size_t len ) {
+	if ( direct->out_len + len > direct->out_alloc ) {
+		size_t new_alloc = MAX( direct->out_len + len, 2 * direct->out_alloc );
+		char* new = tracked_realloc( MEMORY_SCREEN, (void*) direct->out, new_alloc );
+		if ( new == NULL ) return;
+		direct->out = new;
+		direct->out_alloc = new_alloc;
+	}
+
+	memcpy( direct->out + direct->out_len, buf, len );
+	direct->out_len += len;
+}
+
+/**
+ * Append a capability to the frame being built, if the terminal has it.
+ */
+void direct_append_cap( struct direct* direct, const char* cap ) {
+	if ( cap != NULL ) direct_append( direct, cap, strlen( cap ) );
+}
+
+/**
+ * Send the frame that was built to the terminal.
+ */
+void direct_write( struct direct* direct ) {
+	size_t done = 0;
+	while ( done < direct->out_len ) {
+		ssize_t res = write( direct->out_fd, direct->out + done, direct->out_len - done );
+		if ( res < 0 && errno == EINTR ) continue;
+		if ( res <= 0 ) break;
+		done += res;
+	}
+	direct->out_len = 0;
 }
 
 /**
- * Safely retrieve the value of the monotonic clock.
- *
- * The program is aborted if an error occurs.
+ * Switch the terminal to the given attributes, of which only reverse video, bold and dim are rendered.
  */
-void safe_monotonic_clock( struct timespec* timer ) {
-	int res = clock_gettime( CLOCK_MONOTONIC, timer );
+void direct_set_attrs( struct direct* direct, attr_t attrs ) {
+	attrs &= A_REVERSE | A_BOLD | A_DIM;
+	if ( attrs == direct->attrs ) return;
+
+	direct_append_cap( direct, direct->sgr0 );
+	if ( attrs & A_REVERSE ) direct_append_cap( direct, direct->rev );
+	if ( attrs & A_BOLD ) direct_append_cap( direct, direct->bold );
+	if ( attrs & A_DIM ) direct_append_cap( direct, direct->dim );
+	direct->attrs = attrs;
+}
 
-	if ( res < 0 ) {
-		/* An error occurred, resert ncurses */
-		echo();
-		endwin();
+/**
+ * Append a cell to the frame being sent.
+ */
+void direct_append_cell( struct direct* direct, const struct cell* cell ) {
+	direct_set_attrs( direct, cell->attrs );
 
-		/* Abort */
-		perror( "clock_gettime" );
-		exit( EXIT_FAILURE );
+	mbstate_t ps;
+	memset( &ps, 0, sizeof( ps ) );
+	for ( int i = 0; i < CELL_CHARS && cell->chars[i] != L'\0'; i++ ) {
+		char mb[MB_LEN_MAX];
+		size_t len = wcrtomb( mb, cell->chars[i], &ps );
+		if ( len == ( size_t ) -1 ) {
+			mb[0] = '?';
+			len = 1;
+		}
+		direct_append( direct, mb, len );
 	}
 }
 
 /**
- * Add two timespec's in place
+ * Whether a cell shows nothing.
  */
-void add_timespec( struct timespec* base, const struct timespec* add ) {
-	base->tv_sec += add->tv_sec;
-	base->tv_nsec += add->tv_nsec;
+int direct_blank( const struct cell* cell ) {
+	return cell->chars[0] == L' ' && cell->chars[1] == L'\0' && !( cell->attrs & A_REVERSE );
+}
 
-	while ( base->tv_nsec >= 1000000000 ) {
-		base->tv_sec++;
-		base->tv_nsec -= 1000000000;
+/**
+ * Compute the hash of the cells of a row, as FNV-1a over the cells rather than over their bytes.
+ */
+uint64_t direct_hash_row( const struct cell* cells, int len ) {
+	uint64_t hash = UINT64_C( 14695981039346656037 );
+	for ( int c = 0; c < len; c++ ) {
+		hash ^= (uint32_t) cells[c].chars[0] | (uint64_t) cells[c].attrs << 32;
+		hash *= UINT64_C( 1099511628211 );
+		for ( int i = 1; i < CELL_CHARS && cells[c].chars[i] != L'\0'; i++ ) {
+			hash ^= (uint32_t) cells[c].chars[i];
+			hash *= UINT64_C( 1099511628211 );
+		}
 	}
+	return hash;
 }
 
 /**
- * Compute the positive difference of two timespec's and return the results in the given 10th power of second
+ * Take the size of the terminal, or that given by LINES and COLUMNS without one, and draw the next frame from scratch.
  */
-long int diff_timespec( const struct timespec* left, const struct timespec* right, const int expo ) {
-	if ( left->tv_sec < right->tv_sec || ( left->tv_sec == right->tv_sec && left->tv_nsec <= right->tv_nsec ) ) return 0;
-
-	long int diff_sec = left->tv_sec - right->tv_sec;
-	long int diff_nsec;
-	if ( left->tv_nsec < right->tv_nsec ) {
-		diff_sec--;
-		diff_nsec = 1000000000 + left->tv_nsec - right->tv_nsec;
+void direct_resize( struct direct* direct ) {
+	struct winsize size;
+	if ( direct->in_fd >= 0 && ioctl( direct->out_fd, TIOCGWINSZ, &size ) == 0 && size.ws_row > 0 && size.ws_col > 0 ) {
+		direct->rows = size.ws_row;
+		direct->cols = size.ws_col;
 	} else {
-		diff_nsec = left->tv_nsec - right->tv_nsec;
+		const char* lines = getenv( "LINES" );
+		const char* columns = getenv( "COLUMNS" );
+		direct->rows = lines != NULL && atoi( lines ) > 0 ? atoi( lines ) : 24;
+		direct->cols = columns != NULL && atoi( columns ) > 0 ? atoi( columns ) : 80;
 	}
-
-	if ( expo <= 0 ) {
-		for ( int i = 0; i < -expo; i++ )  diff_sec /= 10;
-		return diff_sec;
-	} else {
-		for ( int i = 0; i < expo; i++ )  diff_sec *= 10;
-		for ( int i = 0; i < 9 - expo; i++ )  diff_nsec /= 10;
-		return diff_sec + diff_nsec;
+	direct->full = 1;
+
+	for ( int f = 0; f < 2; f++ ) {
+		struct frame* frame = &direct->frames[f];
+		tracked_free( MEMORY_SCREEN, frame->cells );
+		tracked_free( MEMORY_SCREEN, direct->row_end[f] );
+		tracked_free( MEMORY_SCREEN, direct->row_hash[f] );
+		frame->rows = direct->rows;
+		frame->cols = direct->cols;
+		frame->cells = tracked_calloc( MEMORY_SCREEN, (size_t) direct->rows * direct->cols, sizeof( struct cell ) );
+		direct->row_end[f] = tracked_calloc( MEMORY_SCREEN, direct->rows, sizeof( int ) );
+		direct->row_hash[f] = tracked_calloc( MEMORY_SCREEN, direct->rows, sizeof( uint64_t ) );
+		if ( frame->cells == NULL || direct->row_end[f] == NULL || direct->row_hash[f] == NULL ) {
+			perror( "calloc" );
+			safe_exit( EXIT_FAILURE );
+		}
+		for ( size_t i = 0; i < (size_t) direct->rows * direct->cols; i++ ) frame->cells[i] = blank_cell;
 	}
 }
 
 /**
- * Convert a multibyte string into a newly-allocated wide-character string
+ * Start drawing to the terminal directly, with its capabilities taken from terminfo.
+ *
+ * If tty is not set, nothing is drawn and no key is read, as in batch mode. The program is aborted if an error occurs.
  */
-wchar_t* mbtowca( char* buf, size_t len ) {
-	mbstate_t ps;
-	memset( &ps, 0, sizeof( ps ) );
+void begin_direct( struct direct* direct, int tty ) {
+	memset( direct, 0, sizeof( struct direct ) );
+	direct->out_fd = tty ? STDOUT_FILENO : open( "/dev/null", O_WRONLY );
+	direct->in_fd = tty ? STDIN_FILENO : -1;
+	direct->attrs = (attr_t) -1;
+
+	const char* term = getenv( "TERM" );
+	int err;
+	if ( direct->out_fd < 0 || setupterm( tty || ( term != NULL && strlen( term ) ) ? term : "xterm", direct->out_fd, &err ) != OK ) {
+		fputs( "follow: the terminal could not be set up for the direct renderer\n", stderr );
+		safe_exit( EXIT_FAILURE );
+	}
 
-	char* start = buf;
-	size_t wclen = mbsnrtowcs( NULL, (const char** restrict) &start, len, 0, &ps );
-	if ( wclen == ( size_t ) -1 ) return NULL;
+	direct->cup = direct_cap( "cup" );
+	direct->el = direct_cap( "el" );
+	direct->clear = direct_cap( "clear" );
+	direct->sgr0 = direct_cap( "sgr0" );
+	direct->rev = direct_cap( "rev" );
+	direct->bold = direct_cap( "bold" );
+	direct->dim = direct_cap( "dim" );
+	direct->csr = direct_cap( "csr" );
+	direct->ind = direct_cap( "ind" );
+	direct->ri = direct_cap( "ri" );
+	if ( direct->ind == NULL ) direct->ind = "\n";
+	if ( direct->cup == NULL || direct->el == NULL || direct->clear == NULL ) {
+		fputs( "follow: the terminal lacks the capabilities needed by the direct renderer\n", stderr );
+		safe_exit( EXIT_FAILURE );
+	}
 
-	wchar_t* ret = calloc( wclen + 1, sizeof( wchar_t ) );
-	if ( ret == NULL ) return NULL;
+	/* Writing to the last cell scrolls the screen on a terminal that wraps at once */
+	direct->corner = tigetflag( "am" ) <= 0 || tigetflag( "xenl" ) > 0;
 
-	memset( &ps, 0, sizeof( ps ) );
-	start = buf;
-	wclen = mbsnrtowcs( ret, (const char** restrict) &start, len, wclen + 1, &ps );
+	for ( int k = 0; direct_keys[k].cap != NULL || direct_keys[k].seq != NULL; k++ ) {
+		if ( direct_keys[k].cap != NULL ) direct_keys[k].seq = direct_cap( direct_keys[k].cap );
+	}
 
-	if ( wclen == ( size_t ) -1 ) {
-		free( ret );
-		return NULL;
-	} else {
-		return ret;
+	/* The rest of an escape sequence is waited for as long as ncurses does, including its default */
+	const char* escape_delay = getenv( "ESCDELAY" );
+	direct->escape_delay = escape_delay != NULL && atoi( escape_delay ) > 0 ? atoi( escape_delay ) : 1000;
+
+	if ( tty ) {
+		/* Keys are read one by one without waiting and without echo, while the signals are still generated */
+		struct termios mode;
+		if ( tcgetattr( direct->in_fd, &direct_termios ) < 0 ) {
+			perror( "tcgetattr" );
+			safe_exit( EXIT_FAILURE );
+		}
+		mode = direct_termios;
+		mode.c_lflag &= ~( ICANON | ECHO );
+		mode.c_iflag &= ~( ICRNL | IXON );
+		mode.c_cc[VMIN] = 0;
+		mode.c_cc[VTIME] = 0;
+		tcsetattr( direct->in_fd, TCSAFLUSH, &mode );
+
+		/* The alternate screen, without cursor and with the keypad sending its sequences, as ncurses does */
+		direct->out_len = 0;
+		direct_append_cap( direct, direct_cap( "smcup" ) );
+		direct_append_cap( direct, direct_cap( "civis" ) );
+		direct_append_cap( direct, direct_cap( "smkx" ) );
+		direct_write( direct );
+
+		direct_restore_len = 0;
+		const char* restore[4] = { direct->sgr0, direct_cap( "cnorm" ), direct_cap( "rmkx" ), direct_cap( "rmcup" ) };
+		for ( int i = 0; i < 4; i++ ) {
+			if ( restore[i] == NULL || direct_restore_len + strlen( restore[i] ) >= sizeof( direct_restore ) ) continue;
+			memcpy( direct_restore + direct_restore_len, restore[i], strlen( restore[i] ) );
+			direct_restore_len += strlen( restore[i] );
+		}
+		direct_restore_fd = direct->out_fd;
+
+		signal( SIGWINCH, direct_resize_signal );
 	}
+
+	direct_resize( direct );
 }
 
 /**
- * Get the left part of the title line.
- *
- * This is just the current time.
+ * Scroll the part of the terminal where the rows of the new frame are those of the previous one moved up or down, if
+ * any, and the previous frame alike.
+ */
+void direct_scroll( struct direct* direct ) {
+	const int rows = direct->rows;
+	const int cols = direct->cols;
+	const uint64_t* prev_hash = direct->row_hash[0];
+	const uint64_t* new_hash = direct->row_hash[1];
+	const int* new_end = direct->row_end[1];
+
+	if ( direct->csr == NULL ) return;
+
+	/* Find the shift for which most of the rows that are not blank are found again; new row y is previous row y + shift */
+	int best = 0;
+	int best_count = -1;
+	for ( int i = 0; i <= rows; i++ ) {
+		const int shift = ( i % 2 == 0 ? 1 : -1 ) * ( ( i + 1 ) / 2 ); /* 0 first, so that it wins ties */
+		if ( shift < 0 && direct->ri == NULL ) continue;
+
+		int count = 0;
+		for ( int y = MAX( 0, -shift ); y < MIN( rows, rows - shift ); y++ ) {
+			if ( new_end[y] > 0 && new_hash[y] == prev_hash[y + shift] ) count++;
+		}
+		if ( count > best_count ) {
+			best = shift;
+			best_count = count;
+		}
+	}
+	if ( best == 0 ) return;
+
+	/* The region spans the rows that are found again, where they were and where they are */
+	int top = -1;
+	int bottom = -1;
+	for ( int y = MAX( 0, -best ); y < MIN( rows, rows - best ); y++ ) {
+		if ( new_end[y] > 0 && new_hash[y] == prev_hash[y + best] ) {
+			if ( top < 0 ) top = y;
+			bottom = y;
+		}
+	}
+	const int first = best > 0 ? top : top + best;
+	const int last = best > 0 ? bottom + best : bottom;
+	const int n = abs( best );
+
+	/* The rows that appear are blank, with the default attributes */
+	direct_set_attrs( direct, 0 );
+	direct_append_cap( direct, tiparm( direct->csr, first, last ) );
+	direct_append_cap( direct, tiparm( direct->cup, best > 0 ? last : first, 0 ) );
+	for ( int i = 0; i < n; i++ ) direct_append_cap( direct, best > 0 ? direct->ind : direct->ri );
+	direct_append_cap( direct, tiparm( direct->csr, 0, rows - 1 ) );
+
+	const int from = best > 0 ? first + n : first;
+	const int to = best > 0 ? first : first + n;
+	const int moved = last - first + 1 - n;
+	struct cell* cells = direct->frames[0].cells;
+	memmove( cells + (size_t) to * cols, cells + (size_t) from * cols, sizeof( struct cell ) * moved * cols );
+	memmove( direct->row_end[0] + to, direct->row_end[0] + from, sizeof( int ) * moved );
+	memmove( direct->row_hash[0] + to, direct->row_hash[0] + from, sizeof( uint64_t ) * moved );
+
+	const int blank = best > 0 ? last - n + 1 : first;
+	for ( int y = blank; y < blank + n; y++ ) {
+		for ( int x = 0; x < cols; x++ ) cells[(size_t) y * cols + x] = blank_cell;
+		direct->row_end[0][y] = 0;
+		direct->row_hash[0][y] = direct_hash_row( cells + (size_t) y * cols, 0 );
+	}
+}
+
+/**
+ * Send the new frame to the terminal, only drawing what changed since the previous one, which it then replaces.
  */
-wchar_t* get_title_left( char* command ) {
-	char hostname[1025];
-	memset( hostname, '\0', sizeof( hostname ) );
-	int hn_res = gethostname( hostname, sizeof( hostname ) - 1 );
+void flush_direct( struct direct* direct ) {
+	const int cols = direct->cols;
+	const struct cell* cells = direct->frames[1].cells;
+	const struct cell* prev_cells = direct->frames[0].cells;
+	direct->out_len = 0;
+
+	for ( int y = 0; y < direct->rows; y++ ) {
+		const struct cell* row = cells + (size_t) y * cols;
+		int end = cols;
+		while ( end > 0 && direct_blank( &row[end - 1] ) ) end--;
+		direct->row_end[1][y] = end;
+		direct->row_hash[1][y] = direct_hash_row( row, end );
+	}
 
-	char buf[512];
-	memset( buf, '\0', sizeof( buf ) );
-	int res;
-	if ( hn_res == 0 ) {
-		res = snprintf( buf, sizeof( buf ), "%s: %s", hostname, command );
+	if ( direct->full ) {
+		direct_set_attrs( direct, 0 );
+		direct_append_cap( direct, direct->clear );
 	} else {
-		res = snprintf( buf, sizeof( buf ), "%s", command );
+		direct_scroll( direct );
 	}
 
-	if ( res == -1 ) {
-		return NULL;
+	for ( int y = 0; y < direct->rows; y++ ) {
+		const struct cell* row = cells + (size_t) y * cols;
+		const struct cell* prev = prev_cells + (size_t) y * cols;
+		const int end = direct->row_end[1][y];
+		const int prev_end = direct->row_end[0][y];
+		if ( !direct->full && direct->row_hash[1][y] == direct->row_hash[0][y] && end == prev_end ) continue;
+
+		/* Cells that changed, from first to last; a row that was blank only needs its text */
+		int first = 0;
+		int last = cols - 1;
+		if ( direct->full || prev_end == 0 ) {
+			last = end - 1;
+		} else {
+			const int len = MAX( end, prev_end );
+			last = len - 1;
+			while ( first < len && memcmp( &row[first], &prev[first], sizeof( struct cell ) ) == 0 ) first++;
+			while ( last >= first && memcmp( &row[last], &prev[last], sizeof( struct cell ) ) == 0 ) last--;
+		}
+		if ( first > last ) continue;
+
+		/* The span starts and ends with whole characters */
+		if ( first > 0 && row[first].chars[0] == L'\0' ) first--;
+		if ( last + 1 < cols && row[last + 1].chars[0] == L'\0' ) last++;
+
+		direct_append_cap( direct, tiparm( direct->cup, y, first ) );
+
+		int x = first;
+		for ( ; x <= last && x < end; x++ ) {
+			if ( row[x].chars[0] == L'\0' ) continue;
+			if ( y == direct->rows - 1 && x + ( x + 1 < cols && row[x + 1].chars[0] == L'\0' ) >= cols - 1 && !direct->corner ) break;
+			direct_append_cell( direct, &row[x] );
+		}
+
+		/* The rest of the span is blank */
+		if ( last >= end && x < cols ) {
+			direct_set_attrs( direct, 0 );
+			direct_append_cap( direct, direct->el );
+		}
 	}
 
-	return mbtowca( buf, MIN( res, sizeof( buf ) ) );
+	/* The new frame becomes the previous one, and the next one is drawn over the cells of the previous one */
+	struct cell* swap_cells = direct->frames[0].cells;
+	direct->frames[0].cells = direct->frames[1].cells;
+	direct->frames[1].cells = swap_cells;
+	int* row_end = direct->row_end[0];
+	direct->row_end[0] = direct->row_end[1];
+	direct->row_end[1] = row_end;
+	uint64_t* row_hash = direct->row_hash[0];
+	direct->row_hash[0] = direct->row_hash[1];
+	direct->row_hash[1] = row_hash;
+
+	direct->full = 0;
+	direct_write( direct );
 }
 
 /**
- * Get the right part of the title line.
- *
- * This is just the current time.
+ * Whether the keys received start with an escape sequence that is not complete, but could still become one of
+ * direct_keys.
  */
-wchar_t* get_title_right() {
-	time_t t = time( NULL );
-
-	struct tm loct;
-	if ( localtime_r( &t, &loct ) == NULL ) {
-		return NULL;
-	}
-
-	char buf[512];
-	memset( buf, '\0', sizeof( buf ) );
-	int res = strftime( buf, sizeof( buf ), "%c", &loct );
-	if ( res == 0 ) {
-		return NULL;
+int direct_unfinished( const struct direct* direct ) {
+	if ( direct->in_len == 0 || direct->in[0] != '\033' ) return 0;
+
+	int prefix = 0;
+	for ( int k = 0; direct_keys[k].cap != NULL || direct_keys[k].seq != NULL; k++ ) {
+		const char* seq = direct_keys[k].seq;
+		if ( seq == NULL ) continue;
+
+		const size_t len = strlen( seq );
+		if ( memcmp( direct->in, seq, MIN( len, direct->in_len ) ) != 0 ) continue;
+		if ( len <= direct->in_len ) return 0;
+		prefix = 1;
 	}
 
-	return mbtowca( buf, res );
+	return prefix;
 }
 
-int show_title( WINDOW* win, int screen_width, wchar_t* const display_title_left, wchar_t* const display_title_right ) {
-	const size_t title_left_len = ( display_title_left == NULL ? 0 : wcslen( display_title_left ) );
-	const size_t title_right_len = ( display_title_right == NULL ? 0 : wcslen( display_title_right ) );
-	const int title_height = 1;
+/**
+ * Time in milliseconds after which read_direct_key() has keys to return without any more input: 0 if it has some
+ * already, the time left until an unfinished escape sequence is given up, or -1 if no key was received.
+ */
+int direct_key_timeout( const struct direct* direct ) {
+	if ( direct->in_len == 0 ) return -1;
+	if ( !direct->escape_pending ) return 0;
 
-	const int right_start = screen_width - title_right_len;
+	struct timespec now;
+	safe_monotonic_clock( &now );
+	return MAX( direct->escape_delay - diff_timespec( &now, &direct->escape_start, 3 ), 0 );
+}
 
-	wattron( win, A_REVERSE );
+/**
+ * Get the next key from the terminal without waiting, as wgetch() does with nodelay set.
+ *
+ * Returns ERR if there is none, and KEY_RESIZE once the terminal was resized.
+ */
+int read_direct_key( struct direct* direct ) {
+	if ( direct_resized ) {
+		direct_resized = 0;
+		direct_resize( direct );
+		return KEY_RESIZE;
+	}
 
-	if ( display_title_left != NULL ) {
-		if ( right_start > title_left_len ) {
-			mvwaddnwstr( win, 0, 0, display_title_left, title_left_len );
-		} else if ( right_start > 4 ) {
-			mvwaddnwstr( win, 0, 0, display_title_left, right_start - 4 );
-			waddnstr( win, "...", 3 );
+	if ( direct->in_fd < 0 ) return ERR;
+
+	if ( direct->in_len < sizeof( direct->in ) ) {
+		ssize_t res = read( direct->in_fd, direct->in + direct->in_len, sizeof( direct->in ) - direct->in_len );
+		if ( res > 0 ) direct->in_len += res;
+	}
+	if ( direct->in_len == 0 ) return ERR;
+
+	/* A sequence may be split across reads, so its start is kept until the rest arrives or the delay has passed */
+	if ( direct_unfinished( direct ) ) {
+		struct timespec now;
+		safe_monotonic_clock( &now );
+		if ( !direct->escape_pending ) {
+			direct->escape_pending = 1;
+			direct->escape_start = now;
 		}
+		if ( diff_timespec( &now, &direct->escape_start, 3 ) < direct->escape_delay ) return ERR;
 	}
+	direct->escape_pending = 0;
 
-	if ( display_title_right != NULL ) {
-		if ( right_start >= 0 ) {
-			mvwaddnwstr( win, 0, right_start, display_title_right, title_right_len );
-		} else {
-			mvwaddnwstr( win, 0, 0, display_title_right - right_start, screen_width );
+	int key = (unsigned char) direct->in[0];
+	size_t used = 1;
+
+	/* A sequence that is still not complete is taken as separate keys */
+	if ( key == '\033' ) {
+		for ( int k = 0; direct_keys[k].cap != NULL || direct_keys[k].seq != NULL; k++ ) {
+			const char* seq = direct_keys[k].seq;
+			if ( seq == NULL ) continue;
+
+			const size_t len = strlen( seq );
+			if ( len <= direct->in_len && memcmp( direct->in, seq, len ) == 0 ) {
+				key = direct_keys[k].key;
+				used = len;
+				break;
+			}
 		}
 	}
 
-	wattroff( win, A_REVERSE );
+	direct->in_len -= used;
+	memmove( direct->in, direct->in + used, direct->in_len );
 
-	return title_height;
+	return key;
 }
 
 int main( int argc, char** argv ) {
@@ -426,6 +4272,28 @@ int main( int argc, char** argv ) {
 	int shell = 0;
 	struct timespec interval = { 1, 0 };
 	int has_title = 1;
+	char* title_format = NULL;
+	int line_numbers = 0;
+	int mouse = 0;
+	long int batch = 0;
+
+	struct pane* panes = NULL;
+	int n_panes = 0;
+
+	char* each = NULL;
+	int each_panes = 0;
+	long int max_procs = 0;
+
+	struct control control = { .fd = -1 };
+	char* control_socket = NULL;
+	char* shm_name = NULL;
+	long int previous_fd = -1;
+	struct timespec oversample = { 0, 0 };
+	long int decode_budget = 0;
+	struct placement self_placement = { .policy = -1 };
+	struct placement command_placement = { .policy = -1 };
+	int direct_renderer = 0;
+	int pin_baseline = 0;
 
 	static struct option long_options[] = {
 		{ "help", 0, NULL, 'h' },
@@ -433,11 +4301,34 @@ int main( int argc, char** argv ) {
 		{ "interval", 1, NULL, 'n' },
 		{ "shell", 0, NULL, 's' },
 		{ "no-title", 0, NULL, 't' },
+		{ "line-numbers", 0, NULL, 'N' },
+		{ "mouse", 0, NULL, 'W' },
+		{ "batch", 1, NULL, 'X' },
+		{ "title-format", 1, NULL, 'T' },
+		{ "pane", 1, NULL, 'p' },
+		{ "config", 1, NULL, 'c' },
+		{ "each", 1, NULL, 'e' },
+		{ "each-panes", 0, NULL, 'E' },
+		{ "max-procs", 1, NULL, 'P' },
+		{ "control", 1, NULL, 'C' },
+		{ "shm", 1, NULL, 'M' },
+		{ "previous-fd", 2, NULL, 'D' },
+		{ "oversample", 1, NULL, 'O' },
+		{ "decode-budget", 1, NULL, 'B' },
+		{ "cpus", 1, NULL, 'A' },
+		{ "sched", 1, NULL, 'Y' },
+		{ "nice", 1, NULL, 'Z' },
+		{ "command-cpus", 1, NULL, 'a' },
+		{ "command-sched", 1, NULL, 'y' },
+		{ "command-nice", 1, NULL, 'z' },
+		{ "renderer", 1, NULL, 'R' },
+		{ "memory-report", 0, NULL, 'U' },
+		{ "baseline", 0, NULL, 'b' },
 		{ 0, 0, NULL, 0 }
 	};
 
 	while ( 1 ) {
-		int opt = getopt_long( argc, argv, "++hvn:st", long_options, NULL );
+		int opt = getopt_long( argc, argv, "++hvn:stNp:c:e:P:", long_options, NULL );
 		if ( opt < 0 ) break;
 		if ( opt == '?' ) exit( 2 );
 		if ( opt == 'h' ) help++;
@@ -445,6 +4336,57 @@ int main( int argc, char** argv ) {
 		if ( opt == 'n' ) safe_parse_positive_timespec( optarg, &interval );
 		if ( opt == 's' ) shell++;
 		if ( opt == 't' ) has_title = 0;
+		if ( opt == 'N' ) line_numbers = 1;
+		if ( opt == 'W' ) mouse = 1;
+		if ( opt == 'X' ) safe_parse_positive_long( optarg, &batch );
+		if ( opt == 'T' ) title_format = optarg;
+		if ( opt == 'p' ) add_job( add_pane( &panes, &n_panes, optarg, &interval ), optarg, shell_command_args( optarg ) );
+		if ( opt == 'c' ) read_pane_file( optarg, &panes, &n_panes, &interval );
+		if ( opt == 'e' ) each = optarg;
+		if ( opt == 'E' ) each_panes = 1;
+		if ( opt == 'P' ) safe_parse_positive_long( optarg, &max_procs );
+		if ( opt == 'C' ) control_socket = optarg;
+		if ( opt == 'M' ) shm_name = optarg;
+		if ( opt == 'O' ) safe_parse_positive_timespec( optarg, &oversample );
+		if ( opt == 'B' ) safe_parse_positive_long( optarg, &decode_budget );
+		if ( opt == 'A' ) {
+			safe_parse_cpu_list( optarg, &self_placement.cpus );
+			self_placement.has_cpus = 1;
+		}
+		if ( opt == 'Y' ) safe_parse_policy( optarg, &self_placement.policy );
+		if ( opt == 'Z' ) {
+			safe_parse_nice( optarg, &self_placement.nice );
+			self_placement.has_nice = 1;
+		}
+		if ( opt == 'a' ) {
+			safe_parse_cpu_list( optarg, &command_placement.cpus );
+			command_placement.has_cpus = 1;
+		}
+		if ( opt == 'y' ) safe_parse_policy( optarg, &command_placement.policy );
+		if ( opt == 'R' ) {
+			if ( strcmp( optarg, "curses" ) == 0 ) {
+				direct_renderer = 0;
+			} else if ( strcmp( optarg, "direct" ) == 0 ) {
+				direct_renderer = 1;
+			} else {
+				fprintf( stderr, "follow: invalid renderer '%s'\n", optarg );
+				exit( 2 );
+			}
+		}
+		if ( opt == 'U' ) memory_report = 1;
+		if ( opt == 'b' ) pin_baseline = 1;
+		if ( opt == 'z' ) {
+			safe_parse_nice( optarg, &command_placement.nice );
+			command_placement.has_nice = 1;
+		}
+		if ( opt == 'D' ) {
+			previous_fd = 3;
+			if ( optarg != NULL ) safe_parse_positive_long( optarg, &previous_fd );
+			if ( previous_fd <= STDERR_FILENO ) {
+				fprintf( stderr, "follow: file descriptor %ld is a standard stream\n", previous_fd );
+				exit( 2 );
+			}
+		}
 	}
 
 	if ( version ) {
@@ -461,8 +4403,9 @@ int main( int argc, char** argv ) {
 		exit( EXIT_SUCCESS );
 	}
 
-	if ( help || argc - optind < 1 ) {
+	if ( help || ( argc - optind < 1 && n_panes == 0 ) ) {
 		fprintf( stderr, "Usage: %s [OPTION...] [--] <command> [arg...]\n", argv[0] );
+		fprintf( stderr, "       %s [OPTION...] --pane=<command> [--pane=<command>...]\n", argv[0] );
 
 		if ( help ) {
 			fputs( "\n", stderr );
@@ -472,6 +4415,43 @@ int main( int argc, char** argv ) {
 			fputs( "  -n --interval=N   Refresh the command every N seconds\n", stderr );
 			fputs( "  -s --shell        Use a shell to execute the command\n", stderr );
 			fputs( "  -t --no-title     Don't show the header line\n", stderr );
+			fputs( "     --title-format=FMT\n", stderr );
+			fputs( "                    Format of the header line, see the manual page\n", stderr );
+			fputs( "  -N --line-numbers Show the number of each line\n", stderr );
+			fputs( "     --baseline     Compare the following outputs with the first one, as the\n", stderr );
+			fputs( "                    B key does\n", stderr );
+			fputs( "     --mouse        Scroll with the mouse wheel\n", stderr );
+			fputs( "  -p --pane=CMD     Add a pane following the shell command CMD\n", stderr );
+			fputs( "  -c --config=FILE  Add a pane for each command listed in FILE\n", stderr );
+			fputs( "  -e --each=LIST    Run the command once for each comma-separated item of LIST,\n", stderr );
+			fputs( "                    replacing {} in the arguments by the item\n", stderr );
+			fputs( "     --each-panes   Show each item of --each in its own pane\n", stderr );
+			fputs( "  -P --max-procs=N  Run at most N commands at the same time\n", stderr );
+			fputs( "     --control=PATH Accept commands on a Unix socket at PATH\n", stderr );
+			fputs( "     --shm=NAME     Publish each output in the shared memory object NAME\n", stderr );
+			fputs( "     --previous-fd[=FD]\n", stderr );
+			fputs( "                    Give the previous output to the command on FD (default 3)\n", stderr );
+			fputs( "     --oversample=N Run the command every N seconds and show the minimum,\n", stderr );
+			fputs( "                    average and maximum of each number at each refresh\n", stderr );
+			fputs( "     --decode-budget=MS\n", stderr );
+			fputs( "                    Spend at most MS milliseconds converting a result\n", stderr );
+			fputs( "                    between two keys\n", stderr );
+			fputs( "     --cpus=LIST    Run on the CPUs of LIST, e.g. 0-3,6\n", stderr );
+			fputs( "     --sched=POLICY Use the scheduling policy other, batch or idle\n", stderr );
+			fputs( "     --nice=N       Run with the nice value N\n", stderr );
+			fputs( "     --command-cpus=LIST\n", stderr );
+			fputs( "     --command-sched=POLICY\n", stderr );
+			fputs( "     --command-nice=N\n", stderr );
+			fputs( "                    The same for the commands, which otherwise inherit\n", stderr );
+			fputs( "                    the settings of follow\n", stderr );
+			fputs( "     --renderer=NAME\n", stderr );
+			fputs( "                    Draw with curses (default), or direct to compose the\n", stderr );
+			fputs( "                    frames without curses and only send the changed cells,\n", stderr );
+			fputs( "                    in one write per frame\n", stderr );
+			fputs( "     --memory-report\n", stderr );
+			fputs( "                    Print the memory allocated by each part of follow on exit\n", stderr );
+			fputs( "     --batch=N      Draw to /dev/null rather than to the terminal and exit\n", stderr );
+			fputs( "                    after N executions of each command\n", stderr );
 			exit( EXIT_SUCCESS );
 		} else {
 			exit( 2 );
@@ -481,72 +4461,235 @@ int main( int argc, char** argv ) {
 	/* Prepare the command to execute */
 	/* ------------------------------ */
 
-	char** command_args;
+	if ( argc - optind >= 1 ) {
+		char** command_args;
+		char* shell_command = NULL;
 
-	if ( shell ) {
-		size_t shell_len = argc - optind; /* (n-1) space in between the arguments, plus the final NULL byte */
-		for ( int argi = optind; argi < argc; argi++ ) shell_len += strlen( argv[ argi ] );
+		if ( shell ) {
+			size_t shell_len = argc - optind; /* (n-1) space in between the arguments, plus the final NULL byte */
+			for ( int argi = optind; argi < argc; argi++ ) shell_len += strlen( argv[ argi ] );
 
-		char* shell_command = malloc( shell_len );
-		if ( shell_command == NULL ) {
-			perror( "malloc" );
-			exit( EXIT_FAILURE );
-		}
+			shell_command = malloc( shell_len );
+			if ( shell_command == NULL ) {
+				perror( "malloc" );
+				exit( EXIT_FAILURE );
+			}
+
+			size_t start = 0;
+			for ( int argi = optind; argi < argc; argi++ ) {
+				if ( argi > optind ) {
+					shell_command[ start ] = ' ';
+					start++;
+					shell_command[ start ] = '\0';
+				}
 
-		size_t start = 0;
-		for ( int argi = optind; argi < argc; argi++ ) {
-			if ( argi > optind ) {
-				shell_command[ start ] = ' ';
-				start++;
-				shell_command[ start ] = '\0';
+				strncpy( shell_command + start, argv[ argi ], shell_len - start );
+				start += strlen( argv[ argi ] );
 			}
 
-			strncpy( shell_command + start, argv[ argi ], shell_len - start );
-			start += strlen( argv[ argi ] );
+			command_args = shell_command_args( shell_command );
+		} else {
+			size_t argn = argc - optind;
+			command_args = malloc( sizeof( char* ) * ( argn + 1 ) );
+			if ( command_args == NULL ) {
+				perror( "malloc" );
+				exit( EXIT_FAILURE );
+			}
+
+			for ( int argi = 0; argi < argn; argi++ ) {
+				command_args[argi] = argv[optind + argi];
+			}
+			command_args[argn] = NULL;
 		}
 
-		command_args = malloc( sizeof( char* ) * 4 );
-		if ( command_args == NULL ) {
-			perror( "malloc" );
-			exit( EXIT_FAILURE );
+		/* The command given as argument is shown first, before the ones from --pane and --config */
+		const int n_prev_panes = n_panes;
+
+		if ( each == NULL ) {
+			add_job( add_pane( &panes, &n_panes, argv[optind], &interval ), argv[optind], command_args );
+		} else {
+			if ( !each_panes ) add_pane( &panes, &n_panes, argv[optind], &interval );
+
+			for ( char* item = strtok( each, "," ); item != NULL; item = strtok( NULL, "," ) ) {
+				char** item_args;
+				if ( shell ) {
+					char* item_command = substitute_item( shell_command, item );
+					if ( item_command == NULL ) {
+						item_command = malloc( strlen( shell_command ) + strlen( item ) + 2 );
+						if ( item_command == NULL ) {
+							perror( "malloc" );
+							exit( EXIT_FAILURE );
+						}
+						sprintf( item_command, "%s %s", shell_command, item );
+					}
+					item_args = shell_command_args( item_command );
+				} else {
+					item_args = substitute_args( command_args, item );
+				}
+
+				if ( each_panes ) {
+					char* name = malloc( strlen( argv[optind] ) + strlen( item ) + 4 );
+					if ( name == NULL ) {
+						perror( "malloc" );
+						exit( EXIT_FAILURE );
+					}
+					sprintf( name, "%s [%s]", argv[optind], item );
+
+					struct pane* pane = add_pane( &panes, &n_panes, name, &interval );
+					pane->show_runtime = 1;
+					add_job( pane, item, item_args );
+				} else {
+					add_job( &panes[n_panes - 1], item, item_args );
+				}
+			}
+
+			/* Run a bounded number of commands at the same time unless told otherwise */
+			if ( max_procs == 0 ) {
+				max_procs = MAX( sysconf( _SC_NPROCESSORS_ONLN ), 1 );
+			}
 		}
 
-		char* shell = getenv( "SHELL" );
-		command_args[0] = ( shell != NULL && strlen( shell ) ) ? shell : "/bin/sh";
-		command_args[1] = "-c";
-		command_args[2] = shell_command;
-		command_args[3] = NULL;
-	} else {
-		size_t argn = argc - optind;
-		command_args = malloc( sizeof( char* ) * ( argn + 1 ) );
-		if ( command_args == NULL ) {
+		const int n_new_panes = n_panes - n_prev_panes;
+		struct pane* new_panes = malloc( sizeof( struct pane ) * n_new_panes );
+		if ( new_panes == NULL ) {
 			perror( "malloc" );
 			exit( EXIT_FAILURE );
 		}
+		memcpy( new_panes, panes + n_prev_panes, sizeof( struct pane ) * n_new_panes );
+		memmove( panes + n_new_panes, panes, sizeof( struct pane ) * n_prev_panes );
+		memcpy( panes, new_panes, sizeof( struct pane ) * n_new_panes );
+		free( new_panes );
+	}
 
-		for ( int argi = 0; argi < argn; argi++ ) {
-			command_args[argi] = argv[optind + argi];
-		}
-		command_args[argn] = NULL;
+	if ( n_panes == 0 || panes[0].n_jobs == 0 ) {
+		fputs( "follow: no command to execute\n", stderr );
+		exit( 2 );
 	}
 
 	/* Check that we are connected to a tty */
 	/* ------------------------------------ */
 
-	if ( !isatty( STDIN_FILENO ) || !isatty( STDOUT_FILENO ) ) {
+	if ( batch == 0 && ( !isatty( STDIN_FILENO ) || !isatty( STDOUT_FILENO ) ) ) {
 		fputs( "Standard input and standard output need to be connected to a TTY\n", stderr );
 		exit( EXIT_FAILURE );
 	}
 
+	for ( int p = 0; p < n_panes; p++ ) {
+		panes[p].previous_fd = previous_fd;
+		panes[p].samples.interval = oversample;
+		panes[p].decode_budget = decode_budget;
+		panes[p].placement = &command_placement;
+		panes[p].pin_baseline = pin_baseline;
+	}
+
+	/* Move to the requested CPUs and scheduling class */
+	/* ----------------------------------------------- */
+
+	const char* failed = NULL;
+	if ( apply_placement( &self_placement, &failed ) < 0 ) {
+		perror( failed );
+		exit( EXIT_FAILURE );
+	}
+
+	/* Compile the title of each pane */
+	/* ------------------------------ */
+
+	if ( has_title ) {
+		char hostname[1025];
+		memset( hostname, '\0', sizeof( hostname ) );
+		int hn_res = gethostname( hostname, sizeof( hostname ) - 1 );
+
+		for ( int p = 0; p < n_panes; p++ ) {
+			const char* format = title_format;
+			if ( format == NULL ) {
+				/* Panes of --each-panes also show how long the command took */
+				if ( panes[p].show_runtime ) {
+					format = hn_res == 0 ? "%h: %c%=%r s - %t" : "%c%=%r s - %t";
+				} else {
+					format = hn_res == 0 ? "%h: %c%=%t" : "%c%=%t";
+				}
+			}
+
+			int res = compile_title( &panes[p].title, format, hostname, panes[p].name );
+			if ( res < 0 ) {
+				perror( "follow: title" );
+				exit( EXIT_FAILURE );
+			} else if ( res > 0 ) {
+				fprintf( stderr, "follow: invalid sequence '%%%c' in title format\n", res );
+				exit( 2 );
+			}
+		}
+	}
+
+	/* Create the shared-memory exports */
+	/* -------------------------------- */
+
+	if ( shm_name != NULL ) {
+		for ( int p = 0; p < n_panes; p++ ) {
+			/* With several panes, each one gets its own region, numbered from 1 */
+			char* name = shm_name;
+			if ( n_panes > 1 ) {
+				name = malloc( strlen( shm_name ) + 16 );
+				if ( name == NULL ) {
+					perror( "malloc" );
+					exit( EXIT_FAILURE );
+				}
+				sprintf( name, "%s.%d", shm_name, p + 1 );
+			}
+
+			panes[p].shm = open_shm_export( name );
+		}
+	}
+
+	/* Open the control socket */
+	/* ----------------------- */
+
+	if ( control_socket != NULL ) {
+		open_control( &control, control_socket );
+	}
+
 	/* Initialise ncurses */
 	/* ------------------ */
 
-	WINDOW* win = initscr();
-	if ( win == NULL ) exit( EXIT_FAILURE );
-	noecho();
-	curs_set( 0 );
-	keypad( win, 1 );
-	nodelay( win, 1 );
+	if ( direct_renderer && mouse ) {
+		fputs( "follow: --mouse needs the curses renderer\n", stderr );
+		exit( 2 );
+	}
+
+	WINDOW* win = NULL;
+	struct direct direct;
+	if ( direct_renderer ) {
+		/* The frames are composed and sent without curses */
+		begin_direct( &direct, batch == 0 );
+	} else {
+		if ( batch > 0 ) {
+			/* Draw to /dev/null, e.g. to profile or benchmark without a terminal; the size is taken from LINES and COLUMNS */
+			FILE* null_out = fopen( "/dev/null", "w" );
+			FILE* null_in = fopen( "/dev/null", "r" );
+			const char* term = getenv( "TERM" );
+			if ( null_out != NULL && null_in != NULL && newterm( term != NULL && strlen( term ) ? term : "xterm", null_out, null_in ) != NULL ) {
+				win = stdscr;
+			}
+		} else {
+			win = initscr();
+		}
+		if ( win == NULL ) exit( EXIT_FAILURE );
+		noecho();
+		curs_set( 0 );
+		keypad( win, 1 );
+		nodelay( win, 1 );
+	}
+	struct screen screen = { .win = win, .frame = direct_renderer ? &direct.frames[1] : NULL };
+
+	if ( mouse ) {
+		/* Only the wheel is used, so there is no need to wait for clicks to be resolved */
+		mouseinterval( 0 );
+#ifdef BUTTON5_PRESSED
+		mousemask( BUTTON4_PRESSED | BUTTON5_PRESSED, NULL );
+#else
+		mousemask( BUTTON4_PRESSED, NULL );
+#endif
+	}
 
 	signal( SIGHUP, safe_signal );
 	signal( SIGINT, safe_signal );
@@ -556,240 +4699,390 @@ int main( int argc, char** argv ) {
 	/* Variables for the main loop */
 	/* --------------------------- */
 
-	int refresh = 2;
-	int cmd_pid = -1;
-	int cmd_fd = -1;
-	struct timespec next_timer = { 0, 0 };
-
-	wchar_t* cmd_title_left = NULL;
-	wchar_t* cmd_title_right = NULL;
-	int output_err = 0;
-	size_t output_len = (size_t) -1;
-	size_t output_alloc = 0;
-	char* output_buf = NULL;
-	wchar_t* display_title_left = NULL;
-	wchar_t* display_title_right = NULL;
-	int display_err = -1;
-	size_t display_len = (size_t) -1;
-	size_t display_alloc = 0;
-	wchar_t* display_buf = NULL;
-	int res_max_height = 0;
-	int res_max_width = 0;
-	size_t lines_alloc = 0;
-	wchar_t** lines = NULL;
-	int* lines_len = NULL;
-
-	int v_offset = 0;
-	int h_offset = 0;
-	int v_end = 0;
+	int focus = 0;
+	int count = 0; /* numeric prefix being typed */
+	int mark_command = 0; /* 'm' or '\'' if the next key is the letter of a mark */
+	int key_pending = 0; /* a key was pushed back, so it must be handled without waiting */
+	int key_timeout = -1; /* time after which keys that were received must be read again, in milliseconds, or -1 */
 
-	while ( 1 ) {
-		/* Start a new command execution if needed */
+	int n_jobs = 0;
+	for ( int p = 0; p < n_panes; p++ ) n_jobs += panes[p].n_jobs;
 
-		if ( refresh && cmd_pid < 0 ) {
-			if ( refresh == 2 ) {
-				safe_monotonic_clock( &next_timer );
-			}
-			add_timespec( &next_timer, &interval );
-			refresh = 0;
+	/* The first entry is the terminal, followed by one per job and then the control socket and its connections */
+	struct pollfd* fd_desc = malloc( sizeof( struct pollfd ) * ( n_jobs + 1 + 1 + CONTROL_MAX_CLIENTS ) );
+	if ( fd_desc == NULL ) safe_exit( EXIT_FAILURE );
 
-			if ( has_title ) {
-				cmd_title_left = get_title_left( argv[optind] );
-				cmd_title_right = get_title_right();
+	while ( 1 ) {
+		/* In batch mode, stop once the result of the last execution of each pane has been drawn */
+		if ( batch > 0 ) {
+			int done = 1;
+			for ( int p = 0; p < n_panes; p++ ) {
+				if ( panes[p].iterations < batch || panes[p].running > 0 || panes[p].converting ) done = 0;
 			}
+			if ( done ) safe_exit( EXIT_SUCCESS );
+		}
 
-			cmd_pid = run_command( command_args, &cmd_fd );
+		/* Start new command executions if needed */
 
-			if ( cmd_pid < 0 ) {
-				display_err = errno;
+		for ( int p = 0; p < n_panes; p++ ) {
+			if ( panes[p].refresh && panes[p].running == 0 && !panes[p].converting ) {
+				start_pane( &panes[p] );
+			}
+		}
 
-				free( display_title_left );
-				free( display_title_right );
+		/* Start pending jobs as long as there are free slots */
 
-				display_title_left = cmd_title_left;
-				display_title_right = cmd_title_right;
+		int n_running = 0;
+		for ( int p = 0; p < n_panes; p++ ) {
+			for ( int j = 0; j < panes[p].n_jobs; j++ ) {
+				if ( panes[p].jobs[j].cmd_pid > 0 ) n_running++;
 			}
+		}
 
-			output_err = 0;
-			output_len = 0;
+		for ( int p = 0; p < n_panes; p++ ) {
+			for ( int j = 0; j < panes[p].n_jobs && ( max_procs == 0 || n_running < max_procs ); j++ ) {
+				if ( panes[p].jobs[j].pending ) {
+					start_job( &panes[p], &panes[p].jobs[j] );
+					if ( panes[p].jobs[j].cmd_pid > 0 ) n_running++;
+				}
+			}
 		}
 
-		/* Wait for either a character to be pressed or timer to elapse */
+		/* Wait for either a character to be pressed, a command to produce output or a timer to elapse */
 
 		struct timespec cur_timer = { 0, 0 };
 		safe_monotonic_clock( &cur_timer );
 
-		struct pollfd fd_desc[2];
-		fd_desc[0].fd = STDIN_FILENO;
+		fd_desc[0].fd = batch > 0 ? -1 : STDIN_FILENO;
 		fd_desc[0].events = POLLIN;
 		fd_desc[0].revents = 0;
-		fd_desc[1].fd = cmd_fd;
-		fd_desc[1].events = POLLIN;
-		fd_desc[1].revents = 0;
 
-		/* If the command is executing, we do not set a timer, because there is no point starting a new call before the current one finishes */
+		/* If a command is executing, we do not set a timer for its pane, because there is no point starting a new call before the current one finishes */
 		/* Rather, we wait for the command result */
-		int timeout = cmd_pid > 0 ? -1 : diff_timespec( &next_timer, &cur_timer, 3 );
+		int timeout = -1;
+		int n_fds = 1;
+		for ( int p = 0; p < n_panes; p++ ) {
+			for ( int j = 0; j < panes[p].n_jobs; j++ ) {
+				fd_desc[n_fds].fd = panes[p].jobs[j].cmd_fd;
+				fd_desc[n_fds].events = POLLIN;
+				fd_desc[n_fds].revents = 0;
+				n_fds++;
+			}
 
-		int pres = poll( fd_desc, 2, timeout );
+			if ( panes[p].running == 0 && !panes[p].paused ) {
+				int pane_timeout = diff_timespec( &panes[p].next_timer, &cur_timer, 3 );
+				if ( timeout < 0 || pane_timeout < timeout ) timeout = pane_timeout;
+			}
+		}
 
-		/* pres == 0 indicates that the timer has elapsed, it is time to refresh the output */
-		if ( pres == 0 && refresh == 0 ) refresh = 1;
+		const int control_fds = n_fds;
+		if ( control.fd >= 0 ) {
+			n_fds += poll_control( &control, fd_desc + control_fds );
+		}
 
-		if ( fd_desc[1].revents ) {
-			int finished = get_command_output( &cmd_pid, &cmd_fd, &output_err, &output_len, &output_alloc, &output_buf );
+		if ( key_timeout >= 0 && ( timeout < 0 || key_timeout < timeout ) ) timeout = key_timeout;
+		if ( key_pending ) timeout = 0;
+		key_pending = 0;
 
-			if ( finished != 0 ) {
-				free( display_title_left );
-				free( display_title_right );
+		/* A conversion in progress continues as soon as the keys have been handled */
+		for ( int p = 0; p < n_panes; p++ ) {
+			if ( panes[p].converting ) timeout = 0;
+		}
 
-				display_title_left = cmd_title_left;
-				display_title_right = cmd_title_right;
+		int pres = poll( fd_desc, n_fds, timeout );
 
-				display_err = output_err;
-				if ( output_err == 0 ) {
-					convert_output( output_len, output_buf, &display_len, &display_alloc, &display_buf, &res_max_height, &res_max_width, &lines_alloc, &lines, &lines_len );
+		/* Timers that have elapsed indicate that it is time to refresh the output */
+		if ( pres >= 0 ) {
+			safe_monotonic_clock( &cur_timer );
+			for ( int p = 0; p < n_panes; p++ ) {
+				if ( panes[p].running == 0 && !panes[p].paused && panes[p].refresh == 0 && diff_timespec( &panes[p].next_timer, &cur_timer, 3 ) == 0 ) {
+					panes[p].refresh = 1;
 				}
 			}
 		}
 
-		/* Prepare window for new output */
-
-		werase( win );
-		int screen_height = getmaxy( win );
-		int screen_width = getmaxx( win );
+		n_fds = 1;
+		for ( int p = 0; p < n_panes; p++ ) {
+			for ( int j = 0; j < panes[p].n_jobs; j++ ) {
+				if ( fd_desc[n_fds].revents ) {
+					read_job( &panes[p], &panes[p].jobs[j] );
+				}
+				n_fds++;
+			}
+		}
 
-		/* Show header line */
+		if ( control.fd >= 0 && pres > 0 ) {
+			service_control( &control, fd_desc + control_fds, panes, n_panes, focus );
+		}
 
-		int title_height = 0;
-		if ( has_title ) {
-			title_height = show_title( win, screen_width, display_title_left, display_title_right );
+		/* Convert the pending results for at most the budget, so that a large one does not delay the keys */
+		if ( decode_budget > 0 ) {
+			struct timespec decode_start, decode_now;
+			safe_monotonic_clock( &decode_start );
+
+			int over = 0;
+			for ( int p = 0; p < n_panes && !over; p++ ) {
+				while ( panes[p].converting && !over ) {
+					continue_pane_conversion( &panes[p] );
+					safe_monotonic_clock( &decode_now );
+					over = diff_timespec( &decode_now, &decode_start, 3 ) >= decode_budget;
+				}
+			}
 		}
 
-		/* Get a key from the terminal and act on it */
+		/* Get a key from the terminal; this comes first, since wgetch() refreshes the window if it was changed */
+
+		const int key = direct_renderer ? read_direct_key( &direct ) : wgetch( win );
+		if ( direct_renderer ) key_timeout = direct_key_timeout( &direct );
+		int screen_height = direct_renderer ? direct.rows : getmaxy( win );
+		int screen_width = direct_renderer ? direct.cols : getmaxx( win );
+
+		/* Each pane has a title line (unless disabled) and gets an equal share of the screen height */
+
+		const int title_height = has_title ? 1 : 0;
+
+		/* A burst of wheel events is merged, and moves the focus to the view under the pointer */
+		const int wheel = key == KEY_MOUSE ? read_wheel( win, panes, n_panes, &focus, screen_height, title_height, &key_pending ) : 0;
+
+		/* Prepare window for new output */
+
+		erase_screen( &screen );
+
+		struct pane* cur = &panes[focus];
+		const int cur_top = focus * screen_height / n_panes;
+		const int cur_height = ( focus + 1 ) * screen_height / n_panes - cur_top;
+		int cur_view_heights[2];
+		layout_views( cur, cur_height - title_height, cur_view_heights );
+		struct viewport* view = &cur->views[cur->view];
+
+		/* Act on the key */
 		/* We do this here because we need to know the size of the display are */
 
 		/* Size of the zone where the output of the command will be display; take into account the header */
-		int display_height = screen_height - title_height;
+		int display_height = cur_view_heights[cur->view];
 		int display_width = screen_width;
 		int v_diff = 0;
 		int h_diff = 0;
 		int past = 0;
 
-		switch ( wgetch( win ) ) {
+		if ( line_numbers && gutter_width( cur->snap ) < display_width ) {
+			display_width -= gutter_width( cur->snap );
+		}
+		if ( shows_diff( cur ) ) display_width--;
+
+		/* Rows of the result as shown, with the removed lines in the inline comparison with the baseline */
+		const int rows = pane_rows( cur );
+
+		/* The numeric prefix of a command, as in less; it defaults to 1 for the commands that move by rows */
+		const int n = count > 0 ? count : 1;
+
+		if ( key != ERR && mark_command != 0 ) {
+			if ( key >= 'a' && key <= 'z' && mark_command == 'm' ) {
+				set_mark( cur, key - 'a', row_line( cur, MIN( MAX( view->v_offset, 0 ), rows - 1 ) ) );
+			} else if ( key >= 'a' && key <= 'z' && cur->marks[key - 'a'].hash != 0 ) {
+				update_marks( cur );
+				view->v_end = 0;
+				view->v_offset = MAX( MIN( line_row( cur, cur->marks[key - 'a'].line ), rows - display_height ), 0 );
+			}
+			mark_command = 0;
+		} else switch ( key ) {
+		case 'm':
+		case '\'':
+			mark_command = key;
+			break;
+		case '0':
+		case '1':
+		case '2':
+		case '3':
+		case '4':
+		case '5':
+		case '6':
+		case '7':
+		case '8':
+		case '9':
+			if ( count < 100000000 ) count = 10 * count + ( key - '0' );
+			break;
 		case 'q':
 			safe_exit( EXIT_SUCCESS );
 			break;
 		case 'r':
 		case 'R':
-			refresh = 2;
+			cur->refresh = 2;
+			break;
+		case '\t':
+			focus = ( focus + 1 ) % n_panes;
+			break;
+		case KEY_BTAB:
+			focus = ( focus + n_panes - 1 ) % n_panes;
+			break;
+		case 'S':
+			if ( cur->n_views == 1 ) {
+				cur->n_views = 2;
+				cur->split_height = ( cur_height - title_height - 1 ) / 2;
+				cur->views[1] = cur->views[0];
+			} else {
+				cur->n_views = 1;
+				cur->views[0] = cur->views[cur->view];
+				cur->view = 0;
+			}
+			break;
+		case 'o':
+			cur->view = ( cur->view + 1 ) % cur->n_views;
+			break;
+		case 'B':
+			toggle_baseline( cur );
+			break;
+		case 'V':
+			cur->side_by_side = !cur->side_by_side;
+			break;
+		case '+':
+			if ( cur->n_views == 2 ) cur->split_height = MIN( cur_view_heights[0] + 1, cur_height - title_height - 2 );
+			break;
+		case '-':
+			if ( cur->n_views == 2 ) cur->split_height = MAX( cur_view_heights[0] - 1, 1 );
 			break;
 		case KEY_LEFT:
-			h_diff = -1;
+			h_diff = -n;
 			break;
 		case KEY_RIGHT:
-			h_diff = 1;
+			h_diff = n;
 			break;
 		case KEY_UP:
 		case 'k':
 		case 'y':
-			v_end = 0;
-			v_diff = -1;
+			view->v_end = 0;
+			v_diff = -n;
 			break;
 		case 'K':
 		case 'Y':
-			v_end = 0;
+			view->v_end = 0;
 			past = 1;
-			v_diff = -1;
+			v_diff = -n;
 			break;
 		case KEY_DOWN:
 		case 'e':
 		case 'j':
-			v_diff = 1;
+			v_diff = n;
 			break;
 		case 'E':
 		case 'J':
-			v_end = 0;
+			view->v_end = 0;
 			past = 1;
-			v_diff = 1;
+			v_diff = n;
 			break;
 		case ' ':
 		case 'f':
-			v_end = 0;
-			v_diff = display_height;
+			view->v_end = 0;
+			v_diff = count > 0 ? count : display_height;
 			break;
 		case 'b':
-			v_end = 0;
-			v_diff = -display_height;
+			view->v_end = 0;
+			v_diff = count > 0 ? -count : -display_height;
 			break;
 		case 'd':
-			v_end = 0;
-			v_diff = display_height / 2;
+			view->v_end = 0;
+			v_diff = count > 0 ? count : display_height / 2;
 			break;
 		case 'u':
-			v_end = 0;
-			v_diff = -display_height / 2;
+			view->v_end = 0;
+			v_diff = count > 0 ? -count : -display_height / 2;
 			break;
 		case 'g':
-			v_end = 0;
-			v_offset = 0;
-			break;
 		case 'G':
-			v_end = 0;
-			v_offset = 0;
-			v_diff = res_max_height;
+			view->v_end = 0;
+			if ( count > 0 ) {
+				/* Line N at the top, as far as the screen can still be filled */
+				view->v_offset = MAX( MIN( line_row( cur, count - 1 ), rows - display_height ), 0 );
+			} else if ( key == 'g' ) {
+				view->v_offset = 0;
+			} else {
+				view->v_offset = 0;
+				v_diff = rows;
+			}
+			break;
+		case '%':
+			view->v_end = 0;
+			view->v_offset = MAX( MIN( (long long int) rows * MIN( count, 100 ) / 100, rows - display_height ), 0 );
 			break;
 		case 'F':
-			v_end = 1;
+			view->v_end = 1;
+			break;
+		case KEY_MOUSE:
+			if ( wheel < 0 ) view->v_end = 0;
+			v_diff = wheel;
 			break;
 		default:
 			break;
 		}
 
-		if ( v_end ) {
-			v_offset = res_max_height > display_height ? res_max_height - display_height : 0;
-		} else if ( v_diff != 0 && past ) {
-			v_offset += v_diff;
+		/* The prefix only applies to the command that follows it */
+		if ( key != ERR && !( key >= '0' && key <= '9' ) ) count = 0;
+
+		if ( v_diff != 0 && past ) {
+			view->v_offset += v_diff;
 		} else if ( v_diff > 0 ) {
-			v_offset = MAX( v_offset, MIN( v_offset + v_diff, MAX( res_max_height - display_height, 0 ) ) );
+			view->v_offset = MAX( view->v_offset, MIN( view->v_offset + v_diff, MAX( rows - display_height, 0 ) ) );
 		} else if ( v_diff < 0 ) {
-			v_offset = MIN( v_offset, MAX( v_offset + v_diff, 0 ) );
+			view->v_offset = MIN( view->v_offset, MAX( view->v_offset + v_diff, 0 ) );
 		}
 
 		if ( h_diff != 0 && past ) {
-			h_offset += h_diff;
+			view->h_offset += h_diff;
 		} else if ( h_diff > 0 ) {
-			h_offset = MAX( h_offset, MIN( h_offset + h_diff, MAX( res_max_width - display_width, 0 ) ) );
+			view->h_offset = MAX( view->h_offset, MIN( view->h_offset + h_diff, MAX( pane_width( cur ) - display_width, 0 ) ) );
 		} else if ( h_diff < 0 ) {
-			h_offset = MIN( h_offset, MAX( h_offset + h_diff, 0 ) );
+			view->h_offset = MIN( view->h_offset, MAX( view->h_offset + h_diff, 0 ) );
 		}
 
-		/* Show command's output */
+		/* Show each pane's header line and command's output */
+
+		for ( int p = 0; p < n_panes; p++ ) {
+			const int pane_top = p * screen_height / n_panes;
+			const int pane_height = ( p + 1 ) * screen_height / n_panes - pane_top;
+			int view_heights[2];
+			layout_views( &panes[p], pane_height - title_height, view_heights );
+
+			if ( panes[p].baseline != NULL ) {
+				update_diff( &panes[p] );
+			}
+			update_marks( &panes[p] );
+
+			if ( has_title && pane_height > 0 ) {
+				/* Highlight the title of the pane that receives the keys when there are several of them */
+				attr_t attrs = ( n_panes > 1 && p == focus ) ? A_REVERSE | A_BOLD : A_REVERSE;
+				show_title( &screen, pane_top, screen_width, attrs, panes[p].title.buf[0], panes[p].title.len[0], panes[p].title.buf[1], panes[p].title.len[1] );
+
+				show_pane_status( &screen, pane_top, screen_width, &panes[p] );
+			}
 
-		if ( display_err != 0 ) {
-			/* display_err is negative before the first command finishes; don't display anything during that time */
-			if ( display_err > 0 ) mvwaddstr( win, 1, 0, strerror( display_err ) );
-		} else if ( v_offset > -display_height && v_offset < res_max_height && h_offset > -display_width && h_offset < res_max_width ) {
-			int v_disp_off = MAX( -v_offset, 0 );
-			int v_start = MAX( v_offset, 0 );
-			int h_disp_off = MAX( -h_offset, 0 );
-			int h_start = MAX( h_offset, 0 );
+			int view_top = pane_top + title_height;
+			for ( int v = 0; v < panes[p].n_views; v++ ) {
+				struct viewport* pane_view = &panes[p].views[v];
 
-			const int v_end = MIN( v_offset + display_height, res_max_height ) - v_start;
-			for ( int v = 0; v < v_end; v++ ) {
-				const int line_len = lines_len[v + v_start];
-				if ( line_len <= h_offset ) {
-					continue;
+				/* Viewports in follow mode stay at the bottom, even when the height changes */
+				if ( pane_view->v_end ) {
+					pane_view->v_offset = MAX( pane_rows( &panes[p] ) - view_heights[v], 0 );
 				}
-				const int h_end = MIN( line_len, h_offset + display_width ) - h_start;
 
-				if ( h_end > 0 ) {
-					mvwaddnwstr( win, v_disp_off + v + title_height, h_disp_off, lines[v + v_start] + h_start, h_end );
+				if ( v > 0 && view_heights[v - 1] > 0 ) {
+					/* Separator between the viewports of a split pane, highlighted next to the one that receives the keys */
+					hline_screen( &screen, view_top, 0, screen_width, v == panes[p].view ? A_BOLD : 0 );
+					view_top++;
 				}
+
+				if ( view_heights[v] > 0 ) {
+					show_pane_output( &screen, &panes[p], pane_view, line_numbers, view_top, view_heights[v], screen_width );
+				}
+				view_top += view_heights[v];
 			}
 		}
 
-		wrefresh( win );
+		if ( direct_renderer ) {
+			flush_direct( &direct );
+		} else {
+			wrefresh( win );
+		}
+		PROBE0( frame_flush );
 	}
 
 	safe_exit( EXIT_SUCCESS );
@@ -16,11 +16,16 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 
+import os
 import sys
 import time
+import codecs
 import locale
 import curses
+import hashlib
+import signal
 import socket
+import selectors
 import subprocess
 import argparse
 
@@ -31,6 +36,38 @@ def positive_float( value ):
 	else:
 		raise ValueError( "Value must be strictly positive" )
 
+def positive_int( value ):
+	parsed = int( value )
+	if parsed > 0:
+		return parsed
+	else:
+		raise ValueError( "Value must be strictly positive" )
+
+# Decode and split the output read in chunks, which are released as they are used, and find the length of the longest
+# line in the same pass
+def split_output( chunks, encoding ):
+	decoder = codecs.getincrementaldecoder( encoding )( errors = "replace" )
+	lines = []
+	width = 0
+	# Pieces of the line that is not complete yet
+	pending = []
+
+	for i, chunk in enumerate( chunks ):
+		chunks[i] = None
+		parts = decoder.decode( chunk ).split( "\n" )
+		if len( parts ) > 1:
+			parts[0] = "".join( pending ) + parts[0]
+			pending = []
+			lines.extend( parts[:-1] )
+			width = max( width, max( map( len, parts[:-1] ) ) )
+		pending.append( parts[-1] )
+
+	pending.append( decoder.decode( b"", final = True ) )
+	lines.append( "".join( pending ) )
+	width = max( width, len( lines[-1] ) )
+
+	return lines, width
+
 locale.setlocale( locale.LC_ALL, '' )
 
 parser = argparse.ArgumentParser()
@@ -40,6 +77,8 @@ parser.add_argument( "arguments", nargs = argparse.REMAINDER, help = "Command to
 parser.add_argument( "--interval", "-n", type = positive_float, default = 1., help = "Update interval time (seconds)" )
 parser.add_argument( "--shell", "-s", action = "store_true", help = "Execute command through a shell" )
 parser.add_argument( "--no-title", "-t", action = "store_true", help = "Don't show the header line" )
+parser.add_argument( "--timeout", type = positive_float, default = None, help = "Kill the command if it still runs after this time (seconds)" )
+parser.add_argument( "--max-bytes", type = positive_int, default = None, help = "Only keep this many bytes of the output" )
 
 args = parser.parse_args()
 
@@ -53,9 +92,22 @@ curses.curs_set( 0 )
 curses.cbreak()
 stdscr.keypad( True )
 
+# The command's output and the keys are waited for together, so that the interface remains responsive while the
+# command executes. ncurses only notices a resize when reading a key, so the signal also wakes up the wait.
+selector = selectors.DefaultSelector()
+selector.register( sys.stdin, selectors.EVENT_READ, "keys" )
+
+wakeup_read, wakeup_write = os.pipe()
+os.set_blocking( wakeup_read, False )
+os.set_blocking( wakeup_write, False )
+signal.set_wakeup_fd( wakeup_write )
+signal.signal( signal.SIGWINCH, lambda signum, frame: None )
+selector.register( wakeup_read, selectors.EVENT_READ, "resize" )
+
 res_lines = None
 res_max_height = 0
 res_max_width = 0
+res_hash = None
 refresh = 2
 last_time = None
 disp_time = None
@@ -68,9 +120,17 @@ v_diff = 0
 h_diff = 0
 past = False
 
+process = None
+chunks = []
+kept = 0
+digest = None
+deadline = None
+finished = False
+
 try:
 	while True:
-		if refresh > 0:
+		# A new execution only starts once the previous one has finished
+		if refresh > 0 and process is None:
 			if refresh > 1:
 				last_time = time.monotonic()
 			else:
@@ -81,17 +141,14 @@ try:
 				title = socket.gethostname() + ": " + args.command
 				disp_time = time.strftime( "%c" )
 
-			# Execute the command
+			# Execute the command; its output is read as it comes
 			process = subprocess.Popen( command_args, stdout = subprocess.PIPE, stderr = subprocess.STDOUT, shell = args.shell )
-			stdout, stderr = process.communicate()
-			del process
-
-			# Process the result
-			res_lines = stdout.decode( stdscr.encoding ).split( "\n" )
-
-			# Size of the result in both directions
-			res_max_height = len( res_lines )
-			res_max_width = max( len( line ) for line in res_lines )
+			os.set_blocking( process.stdout.fileno(), False )
+			selector.register( process.stdout, selectors.EVENT_READ, "output" )
+			chunks = []
+			kept = 0
+			digest = hashlib.blake2b()
+			deadline = None if args.timeout is None else time.monotonic() + args.timeout
 
 		stdscr.erase()
 		screen_height, screen_width = stdscr.getmaxyx()
@@ -167,27 +224,77 @@ try:
 		# We want to refresh the window every interval; this is done by waiting for a key to be pressed.
 		# The wait interval is recomputed so that the time interval between two command execution is
 		# as close as possible to the provided value.
+		# While the command executes, there is no point in a timer; rather, we wait for its output, up to its timeout.
 		new_time = time.monotonic()
-		# Remaining time to wait in seconds
-		rem_time = args.interval - ( new_time - last_time )
-		# Convert into milliseconds, which is the unit used by timeout()
-		millis = int( rem_time * 1000 + 0.5 )
-		# Negative value to timeout means "blocking read"; if the we are past target time, we set a zero
-		# timeout, which means non-blocking read.
-		stdscr.timeout( max( millis, 0 ) )
+		if process is None:
+			# Remaining time to wait in seconds; if we are past target time, we do not wait at all
+			rem_time = max( args.interval - ( new_time - last_time ), 0. )
+		elif deadline is not None:
+			rem_time = max( deadline - new_time, 0. )
+		else:
+			rem_time = None
 
 		# Reset these ones
 		v_diff = 0
 		h_diff = 0
 		past = False
 
-		# Get one character from STDIN (or -1 if timeout elapsed)
+		# Get one character from STDIN (or -1 if there is none); keys already read by ncurses come first
+		stdscr.timeout( 0 )
 		c = stdscr.getch()
 
-		# Handle key
 		if c == -1:
-			refresh = 1
-		elif c == ord( 'r' ) or c == ord( 'R' ):
+			for key, events in selector.select( rem_time ):
+				if key.data == "keys":
+					c = stdscr.getch()
+				elif key.data == "resize":
+					# Let ncurses know the new size of the terminal, which then returns KEY_RESIZE
+					try:
+						while os.read( wakeup_read, 64 ):
+							pass
+					except BlockingIOError:
+						pass
+					size = os.get_terminal_size( sys.stdout.fileno() )
+					curses.resizeterm( size.lines, size.columns )
+				elif key.data == "output":
+					data = os.read( process.stdout.fileno(), 65536 )
+					if data:
+						# What is beyond the limit is still read, so that the command can finish, but discarded
+						if args.max_bytes is not None:
+							data = data[ :args.max_bytes - kept ]
+						if data:
+							chunks.append( data )
+							digest.update( data )
+							kept += len( data )
+					else:
+						finished = True
+
+			new_time = time.monotonic()
+			if process is not None and deadline is not None and new_time >= deadline:
+				# The output produced so far is kept; the pipe is closed in case the command left processes behind
+				process.kill()
+				finished = True
+
+			if finished:
+				selector.unregister( process.stdout )
+				process.stdout.close()
+				process.wait()
+				process = None
+				deadline = None
+				finished = False
+
+				# Process the result, unless it is the same as the one displayed
+				if digest.digest() != res_hash:
+					res_hash = digest.digest()
+					res_lines, res_max_width = split_output( chunks, stdscr.encoding )
+					res_max_height = len( res_lines )
+				chunks = []
+
+			if process is None and refresh == 0 and new_time - last_time >= args.interval:
+				refresh = 1
+
+		# Handle key
+		if c == ord( 'r' ) or c == ord( 'R' ):
 			refresh = 2
 		elif c == ord( 'q' ):
 			raise KeyboardInterrupt
@@ -223,6 +330,10 @@ try:
 except KeyboardInterrupt:
 	pass
 finally:
+	if process is not None:
+		process.kill()
+		process.wait()
+
 	curses.nocbreak()
 	stdscr.keypad( False )
 	curses.echo()
@@ -0,0 +1,9 @@
+#!/bin/sh
+#
+# Workload for profile-guided optimisation: lines much wider than the screen, as in logs or JSON documents
+
+awk 'BEGIN {
+	s = ""
+	for ( i = 0; i < 400; i++ ) s = s "{\"key\":" i ",\"v\":\"abcdefghij\"}"
+	for ( i = 0; i < 2000; i++ ) print i ": " s
+}'
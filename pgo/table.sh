@@ -0,0 +1,9 @@
+#!/bin/sh
+#
+# Workload for profile-guided optimisation: a large ASCII table, as shown by ps, ls -l, df, etc.
+
+awk 'BEGIN {
+	for ( i = 0; i < 50000; i++ ) {
+		printf "%8d  %-24s %12.3f %10d  %s\n", i, "process-" ( i * 31 ) % 977, i * 1.37, ( i * 7919 ) % 100000, i % 3 ? "running" : "sleeping"
+	}
+}'
@@ -0,0 +1,29 @@
+#!/bin/sh
+#
+# Record the profile of an instrumented build of follow for profile-guided optimisation
+#
+# Usage: train.sh FOLLOW
+#
+# FOLLOW is run in batch mode, i.e. without a terminal, on the workloads of this directory, which produce outputs
+# representative of what follow decodes and draws: large ASCII tables, text with many multi-byte characters and long
+# lines. Each one is run with and without line numbers, then all of them at once in panes.
+
+set -e
+
+follow="$1"
+dir=$(dirname "$0")
+
+# The outputs are decoded as UTF-8 on a screen of a common size
+LC_ALL=C.UTF-8
+LINES=50
+COLUMNS=160
+export LC_ALL LINES COLUMNS
+
+for workload in table utf8 long-lines; do
+	echo "  TRAIN    $workload"
+	"$follow" --batch=20 -n 0.01 -- sh "$dir/$workload.sh"
+	"$follow" --batch=20 -n 0.01 -N -- sh "$dir/$workload.sh"
+done
+
+echo "  TRAIN    panes"
+"$follow" --batch=20 -n 0.01 -p "sh '$dir/table.sh'" -p "sh '$dir/utf8.sh'" -p "sh '$dir/long-lines.sh'"
@@ -0,0 +1,17 @@
+#!/bin/sh
+#
+# Workload for profile-guided optimisation: text made mostly of multi-byte UTF-8 characters
+
+awk 'BEGIN {
+	words[0] = "Größenänderung"
+	words[1] = "Ελληνικά"
+	words[2] = "Русский"
+	words[3] = "日本語のテキスト"
+	words[4] = "✓ → ✗"
+	words[5] = "中文字符"
+	for ( i = 0; i < 20000; i++ ) {
+		line = i ":"
+		for ( j = 0; j < 8; j++ ) line = line " " words[( i + j * 7 ) % 6]
+		print line
+	}
+}'
@@ -0,0 +1,74 @@
+/**
+ * alloc-count - count the heap allocations of a program, loaded with LD_PRELOAD (test of follow)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* Allocator of the C library, which the functions below wrap */
+extern void* __libc_malloc( size_t size );
+extern void* __libc_calloc( size_t n, size_t size );
+extern void* __libc_realloc( void* ptr, size_t size );
+extern void __libc_free( void* ptr );
+
+static unsigned long int n_malloc = 0;
+static unsigned long int n_calloc = 0;
+static unsigned long int n_realloc = 0;
+static unsigned long int n_free = 0;
+
+void* malloc( size_t size ) {
+	n_malloc++;
+	return __libc_malloc( size );
+}
+
+void* calloc( size_t n, size_t size ) {
+	n_calloc++;
+	return __libc_calloc( n, size );
+}
+
+void* realloc( void* ptr, size_t size ) {
+	n_realloc++;
+	return __libc_realloc( ptr, size );
+}
+
+void free( void* ptr ) {
+	if ( ptr != NULL ) n_free++;
+	__libc_free( ptr );
+}
+
+/**
+ * Write the counts to the file given by ALLOC_COUNT_FILE on exit.
+ *
+ * Only the program named by ALLOC_COUNT_NAME writes them, since the variables are inherited by the commands it runs.
+ */
+__attribute__(( destructor )) static void write_counts() {
+	const char* path = getenv( "ALLOC_COUNT_FILE" );
+	const char* name = getenv( "ALLOC_COUNT_NAME" );
+	if ( path == NULL || name == NULL || strcmp( program_invocation_short_name, name ) != 0 ) return;
+
+	FILE* file = fopen( path, "w" );
+	if ( file == NULL ) return;
+
+	/* Read now, since fprintf() itself may allocate */
+	const unsigned long int counts[4] = { n_malloc, n_calloc, n_realloc, n_free };
+	fprintf( file, "malloc %lu\ncalloc %lu\nrealloc %lu\nfree %lu\n", counts[0], counts[1], counts[2], counts[3] );
+	fclose( file );
+}
@@ -0,0 +1,68 @@
+#!/bin/sh
+#
+# Check that the refresh cycle does not allocate: the heap calls are counted with an LD_PRELOAD shim over runs of
+# different lengths, which must make the same number of them, and over outputs of different numbers of lines, whose
+# counts may only differ by the few reallocations of buffers that grow geometrically
+
+FOLLOW=${FOLLOW:-./follow}
+SHIM=${SHIM:-$PWD/tests/alloc-count.so}
+
+# Number of heap calls by which outputs ten times longer may differ
+GROWTH_SLACK=${GROWTH_SLACK:-64}
+
+dir=$( mktemp -d ) || exit 99
+trap 'rm -rf "$dir"' EXIT
+
+# Without the shim, e.g. when SHIM points elsewhere, there is nothing to test
+[ -f "$SHIM" ] || exit 77
+
+# count MODE N LINES [OPTION...]: count the heap calls of follow over N executions of a command printing LINES lines,
+# then the item of --each if any and its own process ID, so that no output is skipped as unchanged
+count() {
+	file="$dir/$1-$2-$3"
+	n=$2
+	lines=$3
+	shift 3
+	LD_PRELOAD="$SHIM" ALLOC_COUNT_FILE="$file" ALLOC_COUNT_NAME="${FOLLOW##*/}" LINES=24 COLUMNS=80 \
+		$FOLLOW --batch=$n -n 0.02 "$@" -- sh -c 'seq 1 "$0"; echo "$1"; echo $$' $lines {} || exit 1
+	[ -s "$file" ] || exit 99
+}
+
+total() {
+	awk '{ total += $2 } END { print total }' "$dir/$1"
+}
+
+status=0
+
+# check MODE [OPTION...]
+check() {
+	mode=$1
+	shift
+	for lines in 2000 20000; do
+		count $mode 5 $lines "$@"
+		count $mode 20 $lines "$@"
+
+		if ! cmp -s "$dir/$mode-5-$lines" "$dir/$mode-20-$lines"; then
+			echo "$mode, $lines lines, 5 executions:"
+			cat "$dir/$mode-5-$lines"
+			echo "$mode, $lines lines, 20 executions:"
+			cat "$dir/$mode-20-$lines"
+			status=1
+		fi
+	done
+
+	small=$( total $mode-20-2000 )
+	large=$( total $mode-20-20000 )
+	if [ $large -gt $(( small + GROWTH_SLACK )) ]; then
+		echo "$mode: $small heap calls with 2000 lines, $large with 20000 lines"
+		status=1
+	fi
+}
+
+check default
+check baseline --baseline
+check each --each=a,b,c
+check oversample --oversample=0.01
+check decode-budget --decode-budget=1
+
+exit $status
@@ -0,0 +1,38 @@
+#!/bin/sh
+#
+# Check that a control socket on which a follow listens is not taken over by another one, while a socket left by a
+# follow that was killed is replaced
+
+FOLLOW=${FOLLOW:-./follow}
+
+dir=$( mktemp -d ) || exit 99
+first=
+trap '[ -n "$first" ] && kill $first 2>/dev/null; rm -rf "$dir"' EXIT
+
+sock="$dir/sock"
+
+LINES=24 COLUMNS=80 $FOLLOW --batch=100000 -n 0.1 --control="$sock" -- true &
+first=$!
+
+i=0
+while [ ! -S "$sock" ]; do
+	i=$(( i + 1 ))
+	[ $i -le 100 ] || exit 99
+	sleep 0.1
+done
+
+# The first follow still listens, so the second one must stop with an error and leave the socket alone
+if LINES=24 COLUMNS=80 $FOLLOW --batch=1 -n 0.1 --control="$sock" -- true 2>"$dir/err"; then
+	echo "a second follow took over the control socket"
+	exit 1
+fi
+grep -q "in use" "$dir/err" || { cat "$dir/err"; exit 1; }
+[ -S "$sock" ] || { echo "the control socket was removed"; exit 1; }
+
+# Once the first follow is killed without removing its socket, the socket can be replaced
+kill -9 $first
+wait $first 2>/dev/null
+first=
+[ -S "$sock" ] || exit 99
+
+LINES=24 COLUMNS=80 $FOLLOW --batch=1 -n 0.1 --control="$sock" -- true || { echo "a stale control socket was not replaced"; exit 1; }
@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# Run the decoding harness over the corpus of tests/corpus and over large adversarial outputs generated here, under
+# limits of time and memory, so that both crashes and complexity regressions fail
+
+FUZZ=${FUZZ:-./tests/fuzz-decode}
+CORPUS=${CORPUS:-$( dirname "$0" )/corpus}
+
+# Each run decodes its input about ten times; that of 10 MB takes well under a second when the decoding is linear
+TIME_LIMIT=${TIME_LIMIT:-60}
+MEMORY_LIMIT_KB=${MEMORY_LIMIT_KB:-1048576}
+
+dir=$( mktemp -d ) || exit 99
+trap 'rm -rf "$dir"' EXIT
+
+[ -x "$FUZZ" ] || exit 99
+
+# Outputs of 10 MB of a single byte: no line feed at all, only line feeds, NUL bytes, invalid bytes and lead bytes of
+# sequences that are never completed
+size=10485760
+gen() {
+	head -c $size /dev/zero | tr '\0' "$2" > "$dir/$1" || exit 99
+}
+head -c $size /dev/zero > "$dir/nul-bytes" || exit 99
+gen long-line 'a'
+gen newlines '\n'
+gen invalid '\377'
+gen truncated '\342'
+
+status=0
+for file in "$CORPUS"/* "$dir"/*; do
+	( ulimit -v $MEMORY_LIMIT_KB && exec timeout $TIME_LIMIT "$FUZZ" "$file" )
+	res=$?
+	if [ $res -ne 0 ]; then
+		[ $res -eq 124 ] && echo "$file: timed out after $TIME_LIMIT s"
+		echo "$file: failed with status $res"
+		status=1
+	fi
+done
+
+exit $status
@@ -0,0 +1,50 @@
+#!/bin/sh
+#
+# Check the FOLLOW_* variables received by the commands of several panes
+#
+# Each pane writes its variables to a file per iteration and exits with its own status, which the next iteration of
+# the same pane must see; the output is empty, so its hash is the FNV-1a offset basis.
+#
+# With --oversample, the variables describe the previous execution, whose output is not displayed as it is.
+
+FOLLOW=${FOLLOW:-./follow}
+
+dir=$( mktemp -d ) || exit 99
+trap 'rm -rf "$dir"' EXIT
+
+LINES=24 COLUMNS=80 $FOLLOW --batch=2 -n 0.1 \
+	-p "env | grep ^FOLLOW_ | sort > $dir/1.\$FOLLOW_ITERATION; exit 1" \
+	-p "env | grep ^FOLLOW_ | sort > $dir/2.\$FOLLOW_ITERATION; exit 2" \
+	-p "env | grep ^FOLLOW_ | sort > $dir/3.\$FOLLOW_ITERATION; exit 3" || exit 1
+
+status=0
+for pane in 1 2 3; do
+	expected="FOLLOW_ITERATION=1"
+	if [ "$( cat "$dir/$pane.1" )" != "$expected" ]; then
+		echo "pane $pane, iteration 1: got '$( cat "$dir/$pane.1" )', expected '$expected'"
+		status=1
+	fi
+
+	got=$( sed 's/^FOLLOW_PREV_START=[0-9][0-9]*$/FOLLOW_PREV_START=T/' "$dir/$pane.2" | tr '\n' ' ' )
+	expected="FOLLOW_ITERATION=2 FOLLOW_PREV_EXIT=$pane FOLLOW_PREV_HASH=cbf29ce484222325 FOLLOW_PREV_START=T "
+	if [ "$got" != "$expected" ]; then
+		echo "pane $pane, iteration 2: got '$got', expected '$expected'"
+		status=1
+	fi
+done
+
+LINES=24 COLUMNS=80 $FOLLOW --batch=5 -n 1 --oversample=0.05 -s -- \
+	"echo a \$FOLLOW_ITERATION; env | grep ^FOLLOW_PREV_HASH > $dir/sample.\$FOLLOW_ITERATION" || exit 1
+
+# FNV-1a hashes of "a 1\n", "a 2\n", ...
+k=1
+for hash in c2562782abdd28bf c2599d82abe02718 c25d0782abe3110d c2453d82abcedaee; do
+	k=$(( k + 1 ))
+	expected="FOLLOW_PREV_HASH=$hash"
+	if [ "$( cat "$dir/sample.$k" )" != "$expected" ]; then
+		echo "sample $k: got '$( cat "$dir/sample.$k" )', expected '$expected'"
+		status=1
+	fi
+done
+
+exit $status
@@ -0,0 +1,209 @@
+/**
+ * fuzz-decode - fuzzing harness over the decoding and the line splitting of follow (test of follow)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Each input is converted in the C and in a UTF-8 locale, at once and in slices of several sizes, and the results are
+ * checked against each other and against properties that hold for every input. A violation aborts the program.
+ *
+ * Without LIBFUZZER defined, the inputs are the files given as arguments, which is how make check and AFL (with @@)
+ * run it. With it, the entry point is LLVMFuzzerTestOneInput(), e.g.:
+ *
+ *     clang -g -O1 -fsanitize=fuzzer,address -DLIBFUZZER -I. $(pkg-config --cflags --libs ncursesw) tests/fuzz-decode.c
+ *     ./a.out tests/corpus
+ */
+
+/* The functions to test are those of the program itself */
+#define main follow_main
+#include "../follow.c"
+#undef main
+
+#define check( cond ) do { if ( !( cond ) ) { fprintf( stderr, "check failed: %s (line %d)\n", #cond, __LINE__ ); abort(); } } while ( 0 )
+
+/* Locales in which the inputs are converted; the second one, set by find_utf8_locale(), is skipped if there is none */
+static const char* locales[] = { "C", NULL };
+
+/* Sizes of the slices in which the conversion is made, beyond all at once */
+static const size_t slices[] = { 1, 61, 4096, DECODE_SLICE };
+
+/* Slices of a single byte are only used up to this size, to keep large inputs fast */
+#define SMALL_INPUT 65536
+
+/**
+ * Check the properties that hold for the conversion of any input in the current locale.
+ */
+static void check_snapshot( const uint8_t* data, size_t size, const struct snapshot* snap ) {
+	const wchar_t replacement = MB_CUR_MAX > 1 ? L'\xfffd' : L'?';
+
+	check( snap->display_len != ( size_t ) -1 );
+	check( snap->display_len <= size );
+	check( snap->display_buf[snap->display_len] == L'\0' );
+
+	if ( MB_CUR_MAX == 1 ) {
+		/* In single-byte locales, each byte is one character, and ASCII bytes but NUL are kept as is */
+		check( snap->display_len == size );
+		for ( size_t i = 0; i < size; i++ ) {
+			const wchar_t c = snap->display_buf[i];
+			if ( data[i] != 0 && data[i] < 0x80 ) {
+				check( c == data[i] );
+			} else {
+				check( c == replacement || c >= 0x80 );
+			}
+		}
+	} else {
+		/* ASCII bytes but NUL, among which line feeds, are kept as is and in order, and nothing else becomes ASCII */
+		size_t byte = 0;
+		for ( size_t i = 0; i < snap->display_len; i++ ) {
+			const wchar_t c = snap->display_buf[i];
+			check( c != L'\0' );
+			if ( c >= 0x80 ) continue;
+
+			while ( byte < size && ( data[byte] == 0 || data[byte] >= 0x80 ) ) byte++;
+			check( byte < size && data[byte] == c );
+			byte++;
+		}
+		while ( byte < size && ( data[byte] == 0 || data[byte] >= 0x80 ) ) byte++;
+		check( byte == size );
+	}
+
+	/* The lines cover the whole output, one after the other, separated by single line feeds */
+	size_t n_lf = 0;
+	for ( size_t i = 0; i < size; i++ ) if ( data[i] == '\n' ) n_lf++;
+	const int last_empty = size == 0 || data[size - 1] == '\n';
+	check( (size_t) snap->res_max_height == n_lf + !last_empty );
+
+	size_t pos = 0;
+	int width = 0;
+	for ( int l = 0; l < snap->res_max_height; l++ ) {
+		check( snap->lines[l] == snap->display_buf + pos );
+		check( snap->lines_len[l] >= 0 );
+		check( wmemchr( snap->lines[l], L'\n', snap->lines_len[l] ) == NULL );
+		pos += snap->lines_len[l];
+		if ( pos < snap->display_len ) {
+			check( snap->display_buf[pos] == L'\n' );
+			pos++;
+		}
+		width = MAX( width, snap->lines_len[l] );
+	}
+	check( pos == snap->display_len );
+	check( width == snap->res_max_width );
+}
+
+/**
+ * Check that two conversions of the same input are identical.
+ */
+static void check_same( const struct snapshot* a, const struct snapshot* b ) {
+	check( a->display_len == b->display_len );
+	check( wmemcmp( a->display_buf, b->display_buf, a->display_len ) == 0 );
+	check( a->res_max_height == b->res_max_height );
+	check( a->res_max_width == b->res_max_width );
+	for ( int l = 0; l < a->res_max_height; l++ ) {
+		check( a->lines[l] - a->display_buf == b->lines[l] - b->display_buf );
+		check( a->lines_len[l] == b->lines_len[l] );
+	}
+}
+
+/**
+ * Look for a UTF-8 locale in which to convert the inputs, beyond the C locale.
+ */
+static void find_utf8_locale() {
+	static const char* const utf8_locales[] = { "C.UTF-8", "C.utf8", "en_US.UTF-8" };
+
+	for ( size_t i = 0; i < sizeof( utf8_locales ) / sizeof( utf8_locales[0] ) && locales[1] == NULL; i++ ) {
+		if ( setlocale( LC_ALL, utf8_locales[i] ) != NULL && MB_CUR_MAX > 1 ) {
+			locales[1] = utf8_locales[i];
+		}
+	}
+
+	if ( locales[1] == NULL ) fputs( "fuzz-decode: no UTF-8 locale, only checking the C locale\n", stderr );
+}
+
+int LLVMFuzzerInitialize( int* argc, char*** argv ) {
+	(void) argc;
+	(void) argv;
+	find_utf8_locale();
+	return 0;
+}
+
+int LLVMFuzzerTestOneInput( const uint8_t* data, size_t size ) {
+	const char* buf = (const char*) data;
+
+	for ( size_t i = 0; i < sizeof( locales ) / sizeof( locales[0] ); i++ ) {
+		if ( locales[i] == NULL || setlocale( LC_ALL, locales[i] ) == NULL ) continue;
+
+		struct snapshot* whole = new_snapshot();
+		convert_output( buf, size, whole );
+		check_snapshot( data, size, whole );
+
+		for ( size_t j = 0; j < sizeof( slices ) / sizeof( slices[0] ); j++ ) {
+			if ( slices[j] == 1 && size > SMALL_INPUT ) continue;
+
+			struct snapshot* sliced = new_snapshot();
+			struct conversion conv;
+			begin_conversion( &conv, buf, size, sliced );
+			while ( !continue_conversion( &conv, slices[j] ) );
+			check_same( whole, sliced );
+			release_snapshot( sliced );
+		}
+
+		release_snapshot( whole );
+	}
+
+	return 0;
+}
+
+#ifndef LIBFUZZER
+/**
+ * Run the harness once over each file given as argument.
+ */
+int main( int argc, char** argv ) {
+	find_utf8_locale();
+
+	for ( int i = 1; i < argc; i++ ) {
+		FILE* file = fopen( argv[i], "rb" );
+		if ( file == NULL ) {
+			perror( argv[i] );
+			exit( EXIT_FAILURE );
+		}
+
+		char* data = NULL;
+		size_t size = 0;
+		size_t alloc = 0;
+		for (;;) {
+			if ( size == alloc ) {
+				alloc = MAX( 2 * alloc, 65536 );
+				data = realloc( data, alloc );
+				if ( data == NULL ) {
+					perror( "realloc" );
+					exit( EXIT_FAILURE );
+				}
+			}
+			const size_t n = fread( data + size, 1, alloc - size, file );
+			if ( n == 0 ) break;
+			size += n;
+		}
+		if ( ferror( file ) ) {
+			perror( argv[i] );
+			exit( EXIT_FAILURE );
+		}
+		fclose( file );
+
+		LLVMFuzzerTestOneInput( (const uint8_t*) data, size );
+		free( data );
+	}
+
+	return EXIT_SUCCESS;
+}
+#endif